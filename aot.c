@@ -0,0 +1,93 @@
+/*
+ *  aot.c
+ *  chip8emu
+ *
+ *  Loads ahead-of-time compiled ROMs produced by tools/chip8aot and
+ *  hooks their blocks into the core. Anything the compiler did not
+ *  reach, or that the program overwrote, keeps running interpreted.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <dlfcn.h>
+
+#include "chip8.h"
+#include "romlib.h"
+#include "aot.h"
+
+
+chip8_aot_t *chip8_aot_load(const char *path)
+{
+    void *handle;
+    chip8_aot_t *aot;
+    const u32 *version, *size, *count;
+    const u64 *hash;
+    const chip8_native_block_t *blocks;
+
+    assert(path);
+
+    if ((handle = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == 0)
+        return 0;
+
+    version = dlsym(handle, "chip8_aot_version");
+    hash = dlsym(handle, "chip8_aot_rom_hash");
+    size = dlsym(handle, "chip8_aot_rom_size");
+    count = dlsym(handle, "chip8_aot_block_count");
+    blocks = dlsym(handle, "chip8_aot_blocks");
+
+    // objects from another emulator version may disagree on semantics
+    if (!version || !hash || !size || !count || !blocks || *version != CHIP8_EMU_VERSION) {
+        dlclose(handle);
+        return 0;
+    }
+
+    if ((aot = calloc(1, sizeof(chip8_aot_t))) == 0) {
+        dlclose(handle);
+        return 0;
+    }
+
+    aot->handle = handle;
+    aot->rom_hash = *hash;
+    aot->rom_size = *size;
+    aot->count = *count;
+
+    for (u32 i = 0; i < aot->count; i++)
+        if (blocks[i].pc >= CHIP8_PROG_START)
+            aot->index[blocks[i].pc - CHIP8_PROG_START] = &blocks[i];
+
+    return aot;
+}
+
+void chip8_aot_unload(chip8_aot_t *aot)
+{
+    if (!aot)
+        return;
+
+    dlclose(aot->handle);
+    free(aot);
+}
+
+// only attaches if the loaded program is the one that was compiled
+int chip8_aot_attach(const chip8_aot_t *aot)
+{
+    chip8_image_t img;
+
+    if (!aot) {
+        chip8_set_native_blocks(0);
+        return 1;
+    }
+
+    if (aot->rom_size > CHIP8_PROG_SIZE)
+        return 0;
+
+    chip8_save_image(&img);
+
+    if (chip8_rom_hash(&img.mem[CHIP8_PROG_START], aot->rom_size) != aot->rom_hash)
+        return 0;
+
+    chip8_set_native_blocks(aot->index);
+
+    return 1;
+}
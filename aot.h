@@ -0,0 +1,30 @@
+/*
+ *  aot.h
+ *  chip8emu
+ *
+ *  Loads ahead-of-time compiled ROMs produced by tools/chip8aot and
+ *  hooks their blocks into the core. Anything the compiler did not
+ *  reach, or that the program overwrote, keeps running interpreted.
+ *
+ */
+
+#ifndef AOT_H
+#define AOT_H
+
+#include "chip8.h"
+
+
+typedef struct {
+    void *handle;
+    u64 rom_hash;
+    u32 rom_size;
+    u32 count;
+    const chip8_native_block_t *index[CHIP8_PROG_SIZE];
+} chip8_aot_t;
+
+chip8_aot_t *chip8_aot_load(const char *path);
+void chip8_aot_unload(chip8_aot_t *aot);
+int chip8_aot_attach(const chip8_aot_t *aot);
+
+
+#endif // AOT_H
@@ -0,0 +1,187 @@
+/*
+ *  beeper.c
+ *  chip8emu
+ *
+ *  Square wave beeper driven by the sound timer. The emulation thread
+ *  pushes on/off transitions stamped with the sample they belong to and
+ *  the audio callback synthesizes the wave from them.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "beeper.h"
+
+
+#define BEEPER_TONE 440
+#define BEEPER_EVENTS 256
+
+
+// buffer is the device buffer size in samples, used for latency accounting
+int chip8_beeper_init(chip8_beeper_t *b, u32 rate, u32 buffer)
+{
+    assert(b && rate);
+
+    memset(b, 0, sizeof(chip8_beeper_t));
+
+    if (!chip8_spsc_init(&b->events, sizeof(chip8_beep_t), BEEPER_EVENTS))
+        return 0;
+
+    b->rate = rate;
+    b->tone = BEEPER_TONE;
+    b->amplitude = 8000;
+    b->buffer = buffer;
+
+    return 1;
+}
+
+void chip8_beeper_free(chip8_beeper_t *b)
+{
+    chip8_spsc_free(&b->events);
+}
+
+// called as often as convenient, only transitions are queued
+void chip8_beeper_update(chip8_beeper_t *b, u64 sample, int on, u32 host_ms)
+{
+    chip8_beep_t ev;
+
+    if ((u8)on == b->pushed)
+        return;
+
+    ev.sample = sample;
+    ev.host_ms = host_ms;
+    ev.on = on;
+
+    // a full ring means the consumer stopped, drop and retry later
+    if (chip8_spsc_push(&b->events, &ev))
+        b->pushed = on;
+}
+
+void chip8_beeper_render(chip8_beeper_t *b, s16 *out, u32 count, u32 host_ms)
+{
+    u32 skew = b->rate / 60;
+    const chip8_beep_t *ev = chip8_spsc_peek(&b->events);
+
+    // keep our clock within a frame of the emulated one
+    if (ev && (ev->sample > b->clock + skew + count || ev->sample + skew < b->clock))
+        b->clock = ev->sample;
+
+    for (u32 i = 0; i < count; i++) {
+        while (ev && ev->sample <= b->clock) {
+            // the buffer we fill starts playing once the current one is done
+            u32 heard = host_ms + (u32)((u64)(b->buffer + i) * 1000 / b->rate);
+            u32 latency = heard - ev->host_ms;
+
+            if ((s32)latency >= 0) {
+                b->latency_sum += latency;
+                b->latency_count++;
+                if (latency > b->latency_max)
+                    b->latency_max = latency;
+            }
+
+            b->on = ev->on;
+            chip8_spsc_drop(&b->events);
+            ev = chip8_spsc_peek(&b->events);
+        }
+
+        if (b->on) {
+            out[i] = b->phase < b->rate / 2 ? b->amplitude : -b->amplitude;
+
+            b->phase += b->tone;
+            if (b->phase >= b->rate)
+                b->phase -= b->rate;
+        } else
+            out[i] = 0;
+
+        b->clock++;
+    }
+}
+
+// time from transition push to it leaving the device
+void chip8_beeper_latency(const chip8_beeper_t *b, u32 *avg_ms, u32 *max_ms)
+{
+    *avg_ms = b->latency_count ? (u32)(b->latency_sum / b->latency_count) : 0;
+    *max_ms = b->latency_max;
+}
+
+
+// wav files, 16 bit mono
+
+static void wav_put32(u8 *p, u32 v)
+{
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static void wav_put16(u8 *p, u16 v)
+{
+    p[0] = v; p[1] = v >> 8;
+}
+
+static int wav_header(chip8_wav_t *w)
+{
+    u8 h[44];
+
+    memcpy(h, "RIFF", 4);
+    wav_put32(h + 4, 36 + w->samples * 2);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    wav_put32(h + 16, 16);
+    wav_put16(h + 20, 1);
+    wav_put16(h + 22, 1);
+    wav_put32(h + 24, w->rate);
+    wav_put32(h + 28, w->rate * 2);
+    wav_put16(h + 32, 2);
+    wav_put16(h + 34, 16);
+    memcpy(h + 36, "data", 4);
+    wav_put32(h + 40, w->samples * 2);
+
+    return fseek(w->file, 0, SEEK_SET) == 0 && fwrite(h, sizeof(h), 1, w->file) == 1;
+}
+
+int chip8_wav_open(chip8_wav_t *w, const char *path, u32 rate)
+{
+    assert(w && path);
+
+    w->rate = rate;
+    w->samples = 0;
+
+    if ((w->file = fopen(path, "wb")) == 0)
+        return 0;
+
+    if (!wav_header(w)) {
+        fclose(w->file);
+        return 0;
+    }
+
+    return 1;
+}
+
+int chip8_wav_write(chip8_wav_t *w, const s16 *samples, u32 count)
+{
+    u8 buf[2 * 1024];
+
+    while (count > 0) {
+        u32 n = count < 1024 ? count : 1024;
+
+        for (u32 i = 0; i < n; i++)
+            wav_put16(buf + 2 * i, samples[i]);
+
+        if (fwrite(buf, 2, n, w->file) != n)
+            return 0;
+
+        w->samples += n;
+        samples += n;
+        count -= n;
+    }
+
+    return 1;
+}
+
+int chip8_wav_close(chip8_wav_t *w)
+{
+    // sizes are only known now
+    int ok = wav_header(w);
+
+    return fclose(w->file) == 0 && ok;
+}
@@ -0,0 +1,69 @@
+/*
+ *  beeper.h
+ *  chip8emu
+ *
+ *  Square wave beeper driven by the sound timer. The emulation thread
+ *  pushes on/off transitions stamped with the sample they belong to and
+ *  the audio callback synthesizes the wave from them.
+ *
+ */
+
+#ifndef BEEPER_H
+#define BEEPER_H
+
+#include <stdio.h>
+
+#include "types.h"
+#include "spsc.h"
+
+
+typedef struct {
+    u64 sample;
+    u32 host_ms;
+    u8 on;
+} chip8_beep_t;
+
+typedef struct {
+    chip8_spsc_t events;
+    u32 rate;
+    u32 tone;
+    s16 amplitude;
+    u32 buffer;
+
+    // producer side
+    u8 pushed;
+
+    // consumer side
+    u64 clock;
+    u32 phase;
+    u8 on;
+    u64 latency_sum;
+    u32 latency_max;
+    u32 latency_count;
+} chip8_beeper_t;
+
+int chip8_beeper_init(chip8_beeper_t *b, u32 rate, u32 buffer);
+void chip8_beeper_free(chip8_beeper_t *b);
+
+// emulation thread
+void chip8_beeper_update(chip8_beeper_t *b, u64 sample, int on, u32 host_ms);
+
+// audio thread
+void chip8_beeper_render(chip8_beeper_t *b, s16 *out, u32 count, u32 host_ms);
+void chip8_beeper_latency(const chip8_beeper_t *b, u32 *avg_ms, u32 *max_ms);
+
+
+// headless output
+
+typedef struct {
+    FILE *file;
+    u32 rate;
+    u32 samples;
+} chip8_wav_t;
+
+int chip8_wav_open(chip8_wav_t *w, const char *path, u32 rate);
+int chip8_wav_write(chip8_wav_t *w, const s16 *samples, u32 count);
+int chip8_wav_close(chip8_wav_t *w);
+
+
+#endif // BEEPER_H
@@ -8,6 +8,7 @@
  */
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
@@ -15,7 +16,9 @@
 #include "chip8.h"
 #include "font.h"
 
-chip8_state_t cs;
+// the machine all chip8_* calls operate on, selectable per thread
+static chip8_state_t default_state;
+static __thread chip8_state_t *cs = &default_state;
 
 void chip8_reset_cpu(chip8_cpu_t *cpu)
 {
@@ -33,34 +36,251 @@ void chip8_reset_cpu(chip8_cpu_t *cpu)
 
 
 
+// memory pages
+
+// what every page maps to before anything is loaded or written
+static const u8 chip8_blank_page[CHIP8_PAGE_SIZE];
+
+static u8 *chip8_alloc_page()
+{
+    u8 *page = malloc(CHIP8_PAGE_SIZE);
+    
+    // instructions have no way to fail
+    if (!page) {
+        printf("Out of memory for a page\n");
+        abort();
+    }
+    
+    return page;
+}
+
+// the page a write to addr goes to, copied from the shared one first
+static inline u8 *chip8_writable_page(u16 addr)
+{
+    u32 page = (addr >> 8) & 0xF;
+    
+    if (!(cs->page_owned & (1 << page))) {
+        u8 *copy = chip8_alloc_page();
+        
+        memcpy(copy, cs->page[page], CHIP8_PAGE_SIZE);
+        cs->page[page] = copy;
+        cs->page_owned |= 1 << page;
+    }
+    
+    return cs->page[page];
+}
+
+// stores wrap at 4K like reads. the written page is marked dirty, and
+// so is the one before it when an opcode straddles into the write
+static inline void chip8_poke(u16 addr, u8 value)
+{
+    addr &= 0xFFF;
+    chip8_writable_page(addr)[addr & 0xFF] = value;
+    cs->code_dirty |= (1 << (addr >> 8)) | (1 << (((addr - 1) & 0xFFF) >> 8));
+}
+
+static void chip8_map_pages(const u8 *mem)
+{
+    for (int page = 0; page < 16; page++) {
+        if (cs->page_owned & (1 << page))
+            free(cs->page[page]);
+        
+        cs->page[page] = (u8 *)(mem ? &mem[page << 8] : chip8_blank_page);
+    }
+    
+    cs->page_owned = 0;
+}
+
+// private pages of src are duplicated, shared ones stay shared
+static void chip8_copy_pages(chip8_state_t *dst, const chip8_state_t *src, u16 pages)
+{
+    for (int page = 0; page < 16; page++) {
+        u16 bit = 1 << page;
+        
+        if (!(pages & bit))
+            continue;
+        
+        if (src->page_owned & bit) {
+            if (!(dst->page_owned & bit))
+                dst->page[page] = chip8_alloc_page();
+            
+            memcpy(dst->page[page], src->page[page], CHIP8_PAGE_SIZE);
+            dst->page_owned |= bit;
+        } else {
+            if (dst->page_owned & bit)
+                free(dst->page[page]);
+            
+            dst->page[page] = src->page[page];
+            dst->page_owned &= ~bit;
+        }
+    }
+}
+
+void chip8_release_state()
+{
+    chip8_map_pages(0);
+}
+
+void chip8_save_image(chip8_image_t *img)
+{
+    assert(img);
+    
+    for (int page = 0; page < 16; page++)
+        memcpy(&img->mem[page << 8], cs->page[page], CHIP8_PAGE_SIZE);
+}
+
+// like loading a ROM, cached decoding no longer applies
+void chip8_map_image(const chip8_image_t *img)
+{
+    assert(img);
+    
+    chip8_map_pages(img->mem);
+    cs->decoded = 0;
+    cs->native = 0;
+    cs->code_dirty = 0;
+}
+
+
 void chip8_reset_state()
 {
-    memset(cs.mem, 0, 4096 * sizeof(u8));
-    memset(cs.vram, 0, 64*32 * sizeof(u8));
+    chip8_map_pages(0);
+    memset(cs->vram, 0, 64*32 * sizeof(u8));
+    
+    chip8_write_mem(CHIP8_FONT_ADDR, chip8_font, sizeof(chip8_font));
+    chip8_write_mem(CHIP8_BIG_FONT_ADDR, chip8_big_font, sizeof(chip8_big_font));
     
-    cs.draw_font = 0;
+    cs->vram_seq = 0;
+    cs->decoded = 0;
+    cs->native = 0;
+    cs->breakpoints = 0;
+    cs->code_dirty = 0;
+    cs->cycles = 0;
+    cs->key_wait = 0;
     
     // seed random number generator
-    srand(17);
+    chip8_seed_rng(17);
     
-    chip8_reset_cpu(&cs.cpu);
+    chip8_reset_cpu(&cs->cpu);
 }
 
 
+// instances
+
+chip8_state_t *chip8_select_state(chip8_state_t *state)
+{
+    chip8_state_t *prev = cs;
+    
+    cs = state ? state : &default_state;
+    
+    return prev;
+}
+
+chip8_state_t *chip8_current_state()
+{
+    return cs;
+}
+
+static void chip8_copy_state(chip8_state_t *dst, const chip8_state_t *src)
+{
+    if (dst == src)
+        return;
+    
+    chip8_copy_pages(dst, src, 0xFFFF);
+    memcpy(dst->vram, src->vram, sizeof(chip8_state_t) - offsetof(chip8_state_t, vram));
+}
+
+void chip8_save_state(chip8_state_t *dst)
+{
+    assert(dst);
+    
+    chip8_copy_state(dst, cs);
+}
+
+void chip8_load_state(const chip8_state_t *src)
+{
+    assert(src);
+    
+    chip8_copy_state(cs, src);
+}
+
+// cheaper chip8_load_state for a state that has only executed since it
+// was saved into src: only memory pages and vram written since are copied
+void chip8_restore_state(const chip8_state_t *src)
+{
+    assert(src);
+    
+    u16 pages = cs->code_dirty | src->code_dirty | (cs->page_owned ^ src->page_owned);
+    
+    chip8_copy_pages(cs, src, pages);
+    
+    if (cs->vram_seq != src->vram_seq)
+        memcpy(cs->vram, src->vram, 64*32 * sizeof(u8));
+    
+    memcpy(&cs->vram_seq, &src->vram_seq,
+           sizeof(chip8_state_t) - offsetof(chip8_state_t, vram_seq));
+}
+
+
+// random numbers
+
+void chip8_seed_rng(u32 seed)
+{
+    // xorshift must never hold zero
+    cs->rng = seed ^ 0x9E3779B9;
+    if (!cs->rng)
+        cs->rng = 1;
+}
+
+static u8 chip8_next_random()
+{
+    u32 x = cs->rng;
+    
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    cs->rng = x;
+    
+    return x >> 24;
+}
+
+
+int chip8_load_rom_data(const u8 *data, u32 size)
+{
+    assert(data);
+    
+    if (size > CHIP8_PROG_SIZE)
+        return 0;
+    
+    chip8_write_mem(CHIP8_PROG_START, data, size);
+    cs->decoded = 0;
+    cs->native = 0;
+    cs->code_dirty = 0;
+    
+    return 1;
+}
+
 int chip8_load_rom(const char *path)
 {
     FILE *file;
+    u8 buf[CHIP8_PROG_SIZE + 1];
+    size_t size;
     
     assert(path);
     
     if ((file = fopen(path, "rb")) == 0)
         return 0;
     
-    fread(&cs.mem[0x200], sizeof(u8), 2048, file);
+    // read one byte more than fits to detect oversized images
+    size = fread(buf, sizeof(u8), sizeof(buf), file);
+    
+    if (ferror(file) || size > CHIP8_PROG_SIZE) {
+        fclose(file);
+        return 0;
+    }
     
     fclose(file);
     
-    return 1;
+    return chip8_load_rom_data(buf, size);
 }
 
 
@@ -68,7 +288,20 @@ int chip8_load_rom(const char *path)
 
 void chip8_key_event(chip8_keys_t key, u8 status)
 {
-    cs.cpu.kreg[key] = status;
+    cs->cpu.kreg[key] = status;
+    
+    // a press resumes a cpu parked in key
+    if (status && cs->key_wait) {
+        cs->cpu.dreg[cs->key_wait - 1] = key;
+        cs->key_wait = 0;
+        cs->cpu.pc += 2;
+    }
+}
+
+// nonzero while the cpu is parked until a key is pressed
+int chip8_waiting_key()
+{
+    return cs->key_wait != 0;
 }
 
 
@@ -76,57 +309,116 @@ void chip8_key_event(chip8_keys_t key, u8 status)
 
 void chip8_clear_screen()
 {
-    memset(cs.vram, 0, 64*32 * sizeof(u8));
+    memset(cs->vram, 0, 64*32 * sizeof(u8));
+    cs->vram_seq++;
 }
 
 void chip8_draw_sprite(int sx, int sy, int sn)
 {
-    int ix, iy, vx, vy;    
+    u8 collision = 0;
     
-    cs.cpu.dreg[15] = 0;
+    sx %= 64;
+    sy %= 32;
     
-    for (iy = 0; iy < sn; iy++) {
-        u8 s = cs.mem[cs.cpu.ireg + iy];
+    for (int iy = 0; iy < sn; iy++) {
+        u8 s = chip8_peek(cs, cs->cpu.ireg + iy);
+        u8 *row = &cs->vram[(sy + iy) % 32 * 64];
         
-        for (ix = 0; ix < 8; ix++) {
-            vx = (sx + ix) % 64;
-            vy = (sy + iy) % 32;
-    
-            u8 oldval = cs.vram[vy * 64 + vx];
-            u8 newval = s & (1 << (7-ix)) ? 1 : 0;
+        if (!s)
+            continue;
+        
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        // unwrapped rows xor all eight pixels at once, bit 7-k of the
+        // sprite spreads to byte k
+        if (sx <= 56) {
+            u64 bits = (s * 0x0101010101010101ULL) & 0x0102040810204080ULL;
+            u64 old;
             
-            // check for collision
-            if (oldval && newval)
-                cs.cpu.dreg[15] = 1;
-
-            cs.vram[vy * 64 + vx] ^= newval;
+            bits = ((bits + 0x7F7F7F7F7F7F7F7FULL) >> 7) & 0x0101010101010101ULL;
+            
+            memcpy(&old, row + sx, 8);
+            collision |= (old & bits) != 0;
+            old ^= bits;
+            memcpy(row + sx, &old, 8);
+            continue;
+        }
+#endif
+        
+        for (int ix = 0; ix < 8; ix++) {
+            if (s & (0x80 >> ix)) {
+                u8 *p = &row[(sx + ix) % 64];
+                
+                collision |= *p;
+                *p ^= 1;
+            }
         }
     }
+    
+    cs->cpu.dreg[15] = collision;
+    cs->vram_seq++;
 }
 
-void chip8_draw_font(int sx, int sy)
+u8 *chip8_get_vram()
 {
-    int ix, iy, vx, vy, is;
-    
-    cs.cpu.dreg[15] = 0;
-    
-    is = 0;
-    for (iy = 0; iy < 5; iy++) {
-        for (ix = 0; ix < 4; ix++) {
-            vx = (sx + ix) % 64;
-            vy = (sy + iy) % 32;
-            
-            cs.vram[vy * 64 + vx] ^= chip8_font4x5[cs.cpu.ireg][is];
-            
-            is++;
-        }
+    return cs->vram;
+}
+
+// eight pixels per byte, leftmost in the top bit
+void chip8_pack_vram(const u8 *vram, u8 *bits)
+{
+    for (u32 i = 0; i < 64*32 / 8; i++) {
+        const u8 *p = &vram[i * 8];
+        
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        // pixels are 0 or 1, the multiply gathers byte k into bit 63-k
+        u64 x;
+        
+        memcpy(&x, p, 8);
+        bits[i] = (x * 0x8040201008040201ULL) >> 56;
+#else
+        bits[i] = p[0] << 7 | p[1] << 6 | p[2] << 5 | p[3] << 4 |
+                  p[4] << 3 | p[5] << 2 | p[6] << 1 | p[7];
+#endif
     }
-    
 }
 
-u8 *chip8_get_vram()
+// instructions executed since reset
+u64 chip8_get_cycles()
 {
-    return cs.vram;
+    return cs->cycles;
+}
+
+int chip8_sound_on()
+{
+    return cs->cpu.sound_timer > 0;
+}
+
+// use predecoded instruction codes for the program area, indexed by
+// address - CHIP8_PROG_START. 256 byte pages written to after loading
+// fall back to decoding from memory
+void chip8_set_decode_cache(const u8 *icodes)
+{
+    cs->decoded = icodes;
+}
+
+// same indexing for natively compiled blocks, 0 where there are none
+void chip8_set_native_blocks(const chip8_native_block_t *const *blocks)
+{
+    cs->native = blocks;
+}
+
+void chip8_set_breakpoints(const u8 *bitmap)
+{
+    cs->breakpoints = bitmap;
+}
+
+// stores through the same path as str, so shared pages get copied
+void chip8_write_mem(u16 addr, const u8 *data, u32 size)
+{
+    assert(data);
+    
+    for (u32 i = 0; i < size; i++)
+        chip8_poke(addr + i, data[i]);
 }
 
 // instructions....
@@ -135,60 +427,60 @@ u8 *chip8_get_vram()
 void chip8_instr_scdown(u16 opcode)
 {
     printf("scdown\n");
-    cs.cpu.pc += 2;
+    cs->cpu.pc += 2;
 }
 
 // clear screen
 void chip8_instr_cls(u16 opcode)
 {
     chip8_clear_screen();
-    cs.cpu.pc += 2;
+    cs->cpu.pc += 2;
 }
 
 // return from subroutine
 void chip8_instr_rts(u16 opcode)
 {
-    cs.cpu.pc = cs.cpu.stack[--cs.cpu.sp];
-    cs.cpu.stack[cs.cpu.sp] = 0;
+    cs->cpu.pc = cs->cpu.stack[--cs->cpu.sp];
+    cs->cpu.stack[cs->cpu.sp] = 0;
 }
 
 void chip8_instr_scright(u16 opcode)
 {
     printf("scright\n");
-    cs.cpu.pc += 2;
+    cs->cpu.pc += 2;
 }
 
 void chip8_instr_scleft(u16 opcode)
 {
     printf("scleft\n");
-    cs.cpu.pc += 2;
+    cs->cpu.pc += 2;
 }
 
 void chip8_instr_low(u16 opcode)
 {
     printf("low\n");
-    cs.cpu.pc += 2;
+    cs->cpu.pc += 2;
 }
 
 void chip8_instr_high(u16 opcode)
 {
     printf("high\n");
-    cs.cpu.pc += 2;
+    cs->cpu.pc += 2;
 }
 
 // jump to address
 void chip8_instr_jmp(u16 opcode)
 {
-    cs.cpu.pc = (opcode & 0xFFF);
+    cs->cpu.pc = (opcode & 0xFFF);
 }
 
 // jump to subroutine
 void chip8_instr_jsr(u16 opcode)
 {
     // save return address to stack
-    cs.cpu.stack[cs.cpu.sp++] = cs.cpu.pc + 2;
+    cs->cpu.stack[cs->cpu.sp++] = cs->cpu.pc + 2;
     
-    cs.cpu.pc = (opcode & 0xFFF);
+    cs->cpu.pc = (opcode & 0xFFF);
 }
 
 // skip if register equals immediate
@@ -197,10 +489,10 @@ void chip8_instr_skeqi(u16 opcode)
     u8 r = (opcode & 0xF00) >> 8;
     u8 i = (opcode & 0xFF);
     
-    if (cs.cpu.dreg[r] == i)
-        cs.cpu.pc += 4;
+    if (cs->cpu.dreg[r] == i)
+        cs->cpu.pc += 4;
     else
-        cs.cpu.pc += 2;
+        cs->cpu.pc += 2;
 }
 
 // skip if register not equal immediate
@@ -209,10 +501,10 @@ void chip8_instr_sknei(u16 opcode)
     u8 r = (opcode & 0xF00) >> 8;
     u8 i = (opcode & 0xFF);
     
-    if (cs.cpu.dreg[r] != i)
-        cs.cpu.pc += 4;
+    if (cs->cpu.dreg[r] != i)
+        cs->cpu.pc += 4;
     else
-        cs.cpu.pc += 2;
+        cs->cpu.pc += 2;
 }
 
 // skip if register equals register
@@ -221,10 +513,10 @@ void chip8_instr_skeq(u16 opcode)
     u8 rx = (opcode & 0x0F00) >> 8;
     u8 ry = (opcode & 0x00F0) >> 4;
     
-    if (cs.cpu.dreg[rx] == cs.cpu.dreg[ry])
-        cs.cpu.pc += 4;
+    if (cs->cpu.dreg[rx] == cs->cpu.dreg[ry])
+        cs->cpu.pc += 4;
     else
-        cs.cpu.pc += 2;
+        cs->cpu.pc += 2;
 }
 
 // move immediate into register
@@ -233,8 +525,8 @@ void chip8_instr_movi(u16 opcode)
     u8 r = (opcode & 0x0F00) >> 8;
     u8 i = (opcode & 0xFF);
     
-    cs.cpu.dreg[r] = i;
-    cs.cpu.pc += 2;
+    cs->cpu.dreg[r] = i;
+    cs->cpu.pc += 2;
 }
 
 // add immediate to register
@@ -243,8 +535,8 @@ void chip8_instr_addi(u16 opcode)
     u8 r = (opcode & 0x0F00) >> 8;
     u8 i = (opcode & 0xFF);
 
-    cs.cpu.dreg[r] += i;
-    cs.cpu.pc += 2;
+    cs->cpu.dreg[r] += i;
+    cs->cpu.pc += 2;
 }
 
 // move register to register
@@ -253,8 +545,8 @@ void chip8_instr_mov(u16 opcode)
     u8 rx = (opcode & 0x0F00) >> 8;
     u8 ry = (opcode & 0x00F0) >> 4;
     
-    cs.cpu.dreg[rx] = cs.cpu.dreg[ry];
-    cs.cpu.pc += 2;    
+    cs->cpu.dreg[rx] = cs->cpu.dreg[ry];
+    cs->cpu.pc += 2;    
 }
 
 // or register into register
@@ -263,8 +555,8 @@ void chip8_instr_or(u16 opcode)
     u8 rx = (opcode & 0x0F00) >> 8;
     u8 ry = (opcode & 0x00F0) >> 4;
     
-    cs.cpu.dreg[rx] |= cs.cpu.dreg[ry];
-    cs.cpu.pc += 2;
+    cs->cpu.dreg[rx] |= cs->cpu.dreg[ry];
+    cs->cpu.pc += 2;
 }
 
 // and register into register
@@ -273,8 +565,8 @@ void chip8_instr_and(u16 opcode)
     u8 rx = (opcode & 0x0F00) >> 8;
     u8 ry = (opcode & 0x00F0) >> 4;
     
-    cs.cpu.dreg[rx] &= cs.cpu.dreg[ry];
-    cs.cpu.pc += 2;
+    cs->cpu.dreg[rx] &= cs->cpu.dreg[ry];
+    cs->cpu.pc += 2;
 }
 
 // xor register into register
@@ -283,8 +575,8 @@ void chip8_instr_xor(u16 opcode)
     u8 rx = (opcode & 0x0F00) >> 8;
     u8 ry = (opcode & 0x00F0) >> 4;
     
-    cs.cpu.dreg[rx] ^= cs.cpu.dreg[ry];
-    cs.cpu.pc += 2;
+    cs->cpu.dreg[rx] ^= cs->cpu.dreg[ry];
+    cs->cpu.pc += 2;
 }
 
 void chip8_instr_add(u16 opcode)
@@ -293,13 +585,13 @@ void chip8_instr_add(u16 opcode)
     u8 ry = (opcode & 0x00F0) >> 4;
 
     // carry?
-    if (cs.cpu.dreg[rx] + cs.cpu.dreg[ry] > 255)
-        cs.cpu.dreg[15] = 1;
+    if (cs->cpu.dreg[rx] + cs->cpu.dreg[ry] > 255)
+        cs->cpu.dreg[15] = 1;
     else 
-        cs.cpu.dreg[15] = 0;
+        cs->cpu.dreg[15] = 0;
     
-    cs.cpu.dreg[rx] = cs.cpu.dreg[rx] + cs.cpu.dreg[ry];
-    cs.cpu.pc += 2;
+    cs->cpu.dreg[rx] = cs->cpu.dreg[rx] + cs->cpu.dreg[ry];
+    cs->cpu.pc += 2;
 }
 
 void chip8_instr_sub(u16 opcode)
@@ -308,14 +600,14 @@ void chip8_instr_sub(u16 opcode)
     u8 ry = (opcode & 0x00F0) >> 4;
     
     // carry?
-    if (cs.cpu.dreg[rx] > cs.cpu.dreg[ry])
-        cs.cpu.dreg[15] = 1;
+    if (cs->cpu.dreg[rx] > cs->cpu.dreg[ry])
+        cs->cpu.dreg[15] = 1;
     else
-        cs.cpu.dreg[15] = 0;
+        cs->cpu.dreg[15] = 0;
 
-    cs.cpu.dreg[rx] = cs.cpu.dreg[rx] - cs.cpu.dreg[ry];
+    cs->cpu.dreg[rx] = cs->cpu.dreg[rx] - cs->cpu.dreg[ry];
     
-    cs.cpu.pc += 2;    
+    cs->cpu.pc += 2;    
 }
 
 // shift register right
@@ -323,10 +615,10 @@ void chip8_instr_shr(u16 opcode)
 {
     u8 r = (opcode & 0x0F00) >> 8;
     
-    cs.cpu.dreg[15] = cs.cpu.dreg[r] & 0x1;
-    cs.cpu.dreg[r] >>= 1;
+    cs->cpu.dreg[15] = cs->cpu.dreg[r] & 0x1;
+    cs->cpu.dreg[r] >>= 1;
     
-    cs.cpu.pc += 2;
+    cs->cpu.pc += 2;
 }
 
 // subtract register from register
@@ -336,13 +628,13 @@ void chip8_instr_rsb(u16 opcode)
     u8 ry = (opcode & 0x00F0) >> 4;
     
     // carry?
-    if (cs.cpu.dreg[ry] > cs.cpu.dreg[rx])
-        cs.cpu.dreg[15] = 1;
+    if (cs->cpu.dreg[ry] > cs->cpu.dreg[rx])
+        cs->cpu.dreg[15] = 1;
     else
-        cs.cpu.dreg[15] = 0;
+        cs->cpu.dreg[15] = 0;
     
-    cs.cpu.dreg[rx] = cs.cpu.dreg[ry] - cs.cpu.dreg[rx];
-    cs.cpu.pc += 2;
+    cs->cpu.dreg[rx] = cs->cpu.dreg[ry] - cs->cpu.dreg[rx];
+    cs->cpu.pc += 2;
 }
 
 // shift register left
@@ -350,10 +642,10 @@ void chip8_instr_shl(u16 opcode)
 {
     u8 r = (opcode & 0x0F00) >> 8;
     
-    cs.cpu.dreg[15] = cs.cpu.dreg[r] >> 7;
-    cs.cpu.dreg[r] <<= 1;
+    cs->cpu.dreg[15] = cs->cpu.dreg[r] >> 7;
+    cs->cpu.dreg[r] <<= 1;
         
-    cs.cpu.pc += 2;
+    cs->cpu.pc += 2;
 }
 
 // skip if register not equal register
@@ -362,53 +654,50 @@ void chip8_instr_skne(u16 opcode)
     int rx = (opcode & 0x0F00) >> 8;
     int ry = (opcode & 0x00F0) >> 4;
     
-    if (cs.cpu.dreg[rx] != cs.cpu.dreg[ry])
-        cs.cpu.pc += 4;
+    if (cs->cpu.dreg[rx] != cs->cpu.dreg[ry])
+        cs->cpu.pc += 4;
     else
-        cs.cpu.pc += 2;
+        cs->cpu.pc += 2;
 }
 
 // load index register with immediate
 void chip8_instr_mvi(u16 opcode)
 {
-    cs.draw_font = 0;
-    cs.cpu.ireg = opcode & 0xFFF;
-    cs.cpu.pc += 2;
+    cs->cpu.ireg = opcode & 0xFFF;
+    cs->cpu.pc += 2;
 }
 
 void chip8_instr_jmi(u16 opcode)
 {
-    cs.cpu.pc = cs.cpu.dreg[0] + (opcode & 0xFFF);
+    cs->cpu.pc = cs->cpu.dreg[0] + (opcode & 0xFFF);
 }
 
+// random byte masked by immediate
 void chip8_instr_rand(u16 opcode)
 {
     u8 r = (opcode & 0x0F00) >> 8;
-    u8 rmax = opcode & 0xFF;
+    u8 mask = opcode & 0xFF;
     
-    cs.cpu.dreg[r] = ((float)rand() / (float)RAND_MAX) * rmax+1;
-    cs.cpu.pc += 2;
+    cs->cpu.dreg[r] = chip8_next_random() & mask;
+    cs->cpu.pc += 2;
 }
 
 // draw sprite
 void chip8_instr_sprite(u16 opcode)
 {
-    u8 x = cs.cpu.dreg[(opcode & 0x0F00) >> 8];
-    u8 y = cs.cpu.dreg[(opcode & 0x00F0) >> 4];
+    u8 x = cs->cpu.dreg[(opcode & 0x0F00) >> 8];
+    u8 y = cs->cpu.dreg[(opcode & 0x00F0) >> 4];
     u8 s = (opcode & 0x000F);
  
-    if (cs.draw_font)
-        chip8_draw_font(x, y);
-    else
-        chip8_draw_sprite(x, y, s);
+    chip8_draw_sprite(x, y, s);
     
-    cs.cpu.pc += 2;
+    cs->cpu.pc += 2;
 }
 
 void chip8_instr_xsprite(u16 opcode)
 {
     printf("xsprite\n");
-    cs.cpu.pc += 2;
+    cs->cpu.pc += 2;
 }
 
 // skip if key pressed
@@ -416,10 +705,10 @@ void chip8_instr_skpr(u16 opcode)
 {
     u8 k = (opcode & 0x0F00) >> 8;
 
-    if (cs.cpu.kreg[cs.cpu.dreg[k]])
-        cs.cpu.pc += 4;
+    if (cs->cpu.kreg[cs->cpu.dreg[k]])
+        cs->cpu.pc += 4;
     else
-        cs.cpu.pc += 2;
+        cs->cpu.pc += 2;
 }
 
 // skip if key not pressed
@@ -427,10 +716,10 @@ void chip8_instr_skup(u16 opcode)
 {
     u8 k = (opcode & 0x0F00) >> 8;
     
-    if (!cs.cpu.kreg[cs.cpu.dreg[k]])
-        cs.cpu.pc += 4;
+    if (!cs->cpu.kreg[cs->cpu.dreg[k]])
+        cs->cpu.pc += 4;
     else
-        cs.cpu.pc += 2;
+        cs->cpu.pc += 2;
 }
 
 // get delay timer into vr
@@ -438,14 +727,17 @@ void chip8_instr_gdelay(u16 opcode)
 {
     u8 r = (opcode & 0x0F00) >> 8;
 
-    cs.cpu.dreg[r] = cs.cpu.delay_timer;
-    cs.cpu.pc += 2;
+    cs->cpu.dreg[r] = cs->cpu.delay_timer;
+    cs->cpu.pc += 2;
 }
 
+// wait for a key press and store it in vr
 void chip8_instr_key(u16 opcode)
 {
-    printf("key\n");
-    cs.cpu.pc += 2;
+    u8 r = (opcode & 0x0F00) >> 8;
+    
+    // park, chip8_key_event stores the key and moves on
+    cs->key_wait = r + 1;
 }
 
 // set delay timer to vr
@@ -453,8 +745,8 @@ void chip8_instr_sdelay(u16 opcode)
 {
     u8 r = (opcode & 0x0F00) >> 8;
     
-    cs.cpu.delay_timer = cs.cpu.dreg[r];
-    cs.cpu.pc += 2;
+    cs->cpu.delay_timer = cs->cpu.dreg[r];
+    cs->cpu.pc += 2;
 }
 
 // set sound timer to vr
@@ -462,8 +754,8 @@ void chip8_instr_ssound(u16 opcode)
 {
     u8 r = (opcode & 0x0F00) >> 8;
     
-    cs.cpu.sound_timer = cs.cpu.dreg[r];
-    cs.cpu.pc += 2;
+    cs->cpu.sound_timer = cs->cpu.dreg[r];
+    cs->cpu.pc += 2;
 }
 
 // add vr to index register
@@ -471,8 +763,8 @@ void chip8_instr_adi(u16 opcode)
 {
     u8 r = (opcode & 0x0F00) >> 8;
     
-    cs.cpu.ireg += cs.cpu.dreg[r];
-    cs.cpu.pc += 2;
+    cs->cpu.ireg += cs->cpu.dreg[r];
+    cs->cpu.pc += 2;
 }
 
 // point index register to font
@@ -480,31 +772,32 @@ void chip8_instr_font(u16 opcode)
 {
     u8 r = (opcode & 0x0F00) >> 8;
     
-    cs.draw_font = 1;
-    
-    cs.cpu.ireg = cs.cpu.dreg[r];    
-    cs.cpu.pc += 2;
+    cs->cpu.ireg = CHIP8_FONT_ADDR + (cs->cpu.dreg[r] & 0xF) * 5;
+    cs->cpu.pc += 2;
 }
 
+// point index register to big font
 void chip8_instr_xfont(u16 opcode)
 {
-    printf("xfont\n");
-    cs.cpu.pc += 2;
+    u8 r = (opcode & 0x0F00) >> 8;
+    
+    cs->cpu.ireg = CHIP8_BIG_FONT_ADDR + (cs->cpu.dreg[r] & 0xF) * 10;
+    cs->cpu.pc += 2;
 }
 
 // store binary coded decimal
 void chip8_instr_bcd(u16 opcode)
 {
-    u8 r = cs.cpu.dreg[(opcode & 0x0F00) >> 8];
+    u8 r = cs->cpu.dreg[(opcode & 0x0F00) >> 8];
     u8 d0 = r % 10;
     u8 d1 = r / 10 % 10;
     u8 d2 = r / 100 % 100;
     
-    cs.mem[cs.cpu.ireg] = d2;
-    cs.mem[cs.cpu.ireg+1] = d1;
-    cs.mem[cs.cpu.ireg+2] = d0;
+    chip8_poke(cs->cpu.ireg, d2);
+    chip8_poke(cs->cpu.ireg+1, d1);
+    chip8_poke(cs->cpu.ireg+2, d0);
     
-    cs.cpu.pc += 2;
+    cs->cpu.pc += 2;
 }
 
 // store v0..vx into memory
@@ -513,9 +806,9 @@ void chip8_instr_str(u16 opcode)
     u8 rmax = (opcode & 0x0F00) >> 8;
     
     for (int i = 0; i < rmax; i++)
-        cs.mem[cs.cpu.ireg+i] = cs.cpu.dreg[i];
+        chip8_poke(cs->cpu.ireg+i, cs->cpu.dreg[i]);
     
-    cs.cpu.pc += 2;
+    cs->cpu.pc += 2;
 }
 
 // load v0..vx from memory
@@ -524,15 +817,15 @@ void chip8_instr_ldr(u16 opcode)
     u8 rmax = (opcode & 0x0F00) >> 8;
     
     for (int i = 0; i < rmax; i++)
-        cs.cpu.dreg[i] = cs.mem[cs.cpu.ireg+i];
+        cs->cpu.dreg[i] = chip8_peek(cs, cs->cpu.ireg+i);
     
-    cs.cpu.pc += 2;
+    cs->cpu.pc += 2;
 }
 
 void chip8_instr_unknown(u16 opcode)
 {
     printf("unknown %x\n", opcode);
-    cs.cpu.pc += 2;
+    cs->cpu.pc += 2;
 }
 
 chip8_instruction_t istr_table[] = {
@@ -543,15 +836,15 @@ chip8_instruction_t istr_table[] = {
  {0x00FC, "scleft", P_NONE, &chip8_instr_scleft},
  {0x00FE, "low", P_NONE, &chip8_instr_low},
  {0x00FF, "high", P_NONE, &chip8_instr_high},
- {0x1000, "jmp %x", P_123, &chip8_instr_jmp},
- {0x2000, "jsr %x", P_123, &chip8_instr_jsr},
+ {0x1000, "jmp %03x", P_123, &chip8_instr_jmp},
+ {0x2000, "jsr %03x", P_123, &chip8_instr_jsr},
  {0x3000, "skeq v%x, %d", P_1_23, &chip8_instr_skeqi},
  {0x4000, "skne v%x, %d", P_1_23, &chip8_instr_sknei},
  {0x5000, "skeq v%x, v%x", P_1_2, &chip8_instr_skeq},
  {0x6000, "mov v%x, %d", P_1_23, &chip8_instr_movi},
  {0x7000, "add v%x, %d", P_1_23, &chip8_instr_addi},
  {0x8000, "mov v%x, v%x", P_1_2, &chip8_instr_mov},
- {0x8001, "or v%d, v%x", P_1_2, &chip8_instr_or},
+ {0x8001, "or v%x, v%x", P_1_2, &chip8_instr_or},
  {0x8002, "and v%x, v%x", P_1_2, &chip8_instr_and},
  {0x8003, "xor v%x, v%x", P_1_2, &chip8_instr_xor},
  {0x8004, "add v%x, v%x", P_1_2, &chip8_instr_add},
@@ -560,13 +853,13 @@ chip8_instruction_t istr_table[] = {
  {0x8007, "rsb v%x, v%x", P_1_2, &chip8_instr_rsb},
  {0x800e, "shl v%x", P_1, &chip8_instr_shl},
  {0x9000, "skne v%x, v%x", P_1_2, &chip8_instr_skne},
- {0xa000, "mvi %x", P_123, &chip8_instr_mvi},
- {0xb000, "jmi %x", P_123, &chip8_instr_jmi},
+ {0xa000, "mvi %03x", P_123, &chip8_instr_mvi},
+ {0xb000, "jmi %03x", P_123, &chip8_instr_jmi},
  {0xc000, "rand v%x, %d", P_1_23, &chip8_instr_rand},
- {0xd000, "sprite %d, %d, %d", P_1_2_3, &chip8_instr_sprite},
- {0xd000, "xsprite %d, %d", P_1_2, &chip8_instr_xsprite},
- {0xe09e, "skpr %d", P_1, &chip8_instr_skpr},
- {0xe0a1, "skup %d", P_1, &chip8_instr_skup},
+ {0xd000, "sprite v%x, v%x, %d", P_1_2_3, &chip8_instr_sprite},
+ {0xd000, "xsprite v%x, v%x", P_1_2, &chip8_instr_xsprite},
+ {0xe09e, "skpr v%x", P_1, &chip8_instr_skpr},
+ {0xe0a1, "skup v%x", P_1, &chip8_instr_skup},
  {0xf007, "gdelay v%x", P_1, &chip8_instr_gdelay},
  {0xf00a, "key v%x", P_1, &chip8_instr_key},
  {0xf015, "sdelay v%x", P_1, &chip8_instr_sdelay},
@@ -658,10 +951,11 @@ int chip8_decode_instruction(u16 opcode)
     }
 }
 
-void chip8_disassemble_instruction(u16 opcode)
+// format an instruction into buf, returns the length like snprintf
+int chip8_format_instruction(u16 opcode, char *buf, u32 size)
 {
     int icode, b1, b2, b3;
-    char *s;
+    const char *s;
     
     icode = chip8_decode_instruction(opcode);
     
@@ -672,34 +966,52 @@ void chip8_disassemble_instruction(u16 opcode)
     s = istr_table[icode].mnemonic;
     
     switch (istr_table[icode].format) {
-        case P_NONE: printf(s); break;
-        case P_1: printf(s, b1); break;
-        case P_2: printf(s, b2); break;
-        case P_3: printf(s, b3); break;
-        case P_1_2: printf(s, b1, b2); break;
-        case P_1_2_3: printf(s, b1, b2, b3); break;
-        case P_1_23: printf(s, b1, opcode & 0xFF); break;
-        case P_123: printf(s, opcode & 0xFFF); break;
+        case P_NONE: return snprintf(buf, size, "%s", s);
+        case P_1: return snprintf(buf, size, s, b1);
+        case P_2: return snprintf(buf, size, s, b2);
+        case P_3: return snprintf(buf, size, s, b3);
+        case P_1_2: return snprintf(buf, size, s, b1, b2);
+        case P_1_2_3: return snprintf(buf, size, s, b1, b2, b3);
+        case P_1_23: return snprintf(buf, size, s, b1, opcode & 0xFF);
+        case P_123: return snprintf(buf, size, s, opcode & 0xFFF);
     }
     
-    printf("\n");
+    return 0;
 }
 
-void chip8_execute_step()
+void chip8_disassemble_instruction(u16 opcode)
+{
+    char buf[32];
+    
+    chip8_format_instruction(opcode, buf, sizeof(buf));
+    printf("%s\n", buf);
+}
+
+static inline void chip8_step()
 {
     u16 opcode, icode;
 
     // decrement timers if necessary
-    if (cs.cpu.delay_timer > 0) cs.cpu.delay_timer--;
-    if (cs.cpu.sound_timer > 0) cs.cpu.sound_timer--;
+    if (cs->cpu.delay_timer > 0) cs->cpu.delay_timer--;
+    if (cs->cpu.sound_timer > 0) cs->cpu.sound_timer--;
+    
+    cs->cycles++;
     
     // fetch instruction
-    opcode = (cs.mem[cs.cpu.pc] << 8) | cs.mem[cs.cpu.pc+1];
+    const u8 *p = &cs->page[(cs->cpu.pc >> 8) & 0xF][cs->cpu.pc & 0xFF];
     
-    // decode instruction
-    icode = chip8_decode_instruction(opcode);
+    // one page lookup unless the opcode straddles two
+    if ((cs->cpu.pc & 0xFF) != 0xFF)
+        opcode = (p[0] << 8) | p[1];
+    else
+        opcode = (p[0] << 8) | chip8_peek(cs, cs->cpu.pc+1);
     
-    chip8_disassemble_instruction(opcode);
+    // decode instruction
+    if (cs->decoded && cs->cpu.pc >= CHIP8_PROG_START && cs->cpu.pc < 4095 &&
+        !(cs->code_dirty & (1 << (cs->cpu.pc >> 8))))
+        icode = cs->decoded[cs->cpu.pc - CHIP8_PROG_START];
+    else
+        icode = chip8_decode_instruction(opcode);
     
     // execute instruction
     void (*func)(int) = istr_table[icode].func;
@@ -708,3 +1020,109 @@ void chip8_execute_step()
         func(opcode);
 }
 
+static inline void chip8_block()
+{
+    const chip8_native_block_t *block;
+    
+    // jmi can leave pc past 4K, the block index ends with the program area
+    if (cs->native && cs->cpu.pc >= CHIP8_PROG_START && cs->cpu.pc < 4096 &&
+        (block = cs->native[cs->cpu.pc - CHIP8_PROG_START]) != 0 &&
+        !(cs->code_dirty & block->pages))
+        block->fn(cs);
+    else
+        chip8_step();
+}
+
+void chip8_execute_step()
+{
+    // parked cpus don't execute until chip8_key_event wakes them
+    if (cs->key_wait)
+        return;
+    
+    chip8_step();
+}
+
+// run a native block if one covers pc and its code is unmodified,
+// otherwise interpret a single instruction
+u32 chip8_execute_block()
+{
+    u64 start = cs->cycles;
+    
+    if (cs->key_wait)
+        return 0;
+    
+    chip8_block();
+    
+    return cs->cycles - start;
+}
+
+chip8_run_reason_t chip8_run(u32 budget, u32 stop, u32 *cycles)
+{
+    chip8_state_t *s = cs;
+    u64 start = s->cycles, end = start + budget;
+    u64 frame_end = (start / CHIP8_CYCLES_PER_FRAME + 1) * CHIP8_CYCLES_PER_FRAME;
+    chip8_run_reason_t reason = CHIP8_RUN_BUDGET;
+    
+    // a frame boundary before the budget runs out is just an earlier end
+    if ((stop & CHIP8_STOP_FRAME) && frame_end <= end) {
+        end = frame_end;
+        reason = CHIP8_RUN_FRAME;
+    }
+    
+    if (!(stop & (CHIP8_STOP_VRAM | CHIP8_STOP_SOUND | CHIP8_STOP_BREAKPOINT))) {
+        while (s->cycles < end) {
+            if (s->key_wait) {
+                reason = CHIP8_RUN_KEY_WAIT;
+                break;
+            }
+            
+            chip8_block();
+        }
+    } else {
+        const u8 *bp = stop & CHIP8_STOP_BREAKPOINT ? s->breakpoints : 0;
+        u32 seq = s->vram_seq;
+        int sound = s->cpu.sound_timer > 0;
+        
+        while (s->cycles < end) {
+            if (s->key_wait) {
+                reason = CHIP8_RUN_KEY_WAIT;
+                break;
+            }
+            
+            // native blocks would step over breakpoints. one on pc at
+            // entry stops before anything runs, callers resuming from it
+            // step past it first
+            if (bp) {
+                u16 pc = s->cpu.pc & 0xFFF;
+                
+                if (bp[pc >> 3] & (1 << (pc & 7))) {
+                    reason = CHIP8_RUN_BREAKPOINT;
+                    break;
+                }
+                
+                chip8_step();
+            } else
+                chip8_block();
+            
+            if ((stop & CHIP8_STOP_VRAM) && s->vram_seq != seq) {
+                reason = CHIP8_RUN_VRAM;
+                break;
+            }
+            
+            if ((stop & CHIP8_STOP_SOUND) && (s->cpu.sound_timer > 0) != sound) {
+                reason = CHIP8_RUN_SOUND;
+                break;
+            }
+        }
+    }
+    
+    if (cycles)
+        *cycles = s->cycles - start;
+    
+    return reason;
+}
+
+chip8_run_reason_t chip8_run_frame(u32 *cycles)
+{
+    return chip8_run(CHIP8_CYCLES_PER_FRAME, CHIP8_STOP_FRAME, cycles);
+}
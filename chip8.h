@@ -13,6 +13,22 @@
 #include "types.h"
 
 
+// programs are loaded at 0x200 and may extend to the end of memory
+#define CHIP8_PROG_START 0x200
+#define CHIP8_PROG_SIZE (4096 - CHIP8_PROG_START)
+
+// hex digit glyphs live in the reserved area below the program
+#define CHIP8_FONT_ADDR 0x000
+#define CHIP8_BIG_FONT_ADDR 0x050
+
+// nominal speed, timers still tick once per instruction
+#define CHIP8_FRAMES_PER_SECOND 60
+#define CHIP8_CYCLES_PER_FRAME 10
+#define CHIP8_CYCLES_PER_SECOND (CHIP8_FRAMES_PER_SECOND * CHIP8_CYCLES_PER_FRAME)
+
+// bumped whenever decoding changes so cached analysis is rebuilt
+#define CHIP8_EMU_VERSION 2
+
 typedef struct {
     u8 dreg[16];
     u16 ireg;
@@ -27,17 +43,108 @@ typedef struct {
 void chip8_reset_cpu(chip8_cpu_t *cpu);
 
 
+typedef struct chip8_state chip8_state_t;
+
+// natively compiled straight-line code starting at pc, returns the
+// number of instructions it executed. pages is the mask of 256 byte
+// pages the code was translated from
+typedef u32 (*chip8_native_fn)(chip8_state_t *s);
+
+typedef struct {
+    u16 pc;
+    u16 pages;
+    chip8_native_fn fn;
+} chip8_native_block_t;
+
+
+// memory is 16 pages of 256 bytes. pages start out shared, with a ROM
+// image or a blank page, and are copied privately on their first write
+#define CHIP8_PAGE_SIZE 256
+
 typedef struct {
     u8 mem[4096];
+} chip8_image_t;
+
+// pages and vram lead so chip8_restore_state can copy the rest in one go
+struct chip8_state {
+    u16 page_owned;         // pages privately allocated by this state
+    u8 *page[16];
     u8 vram[64*32];
-    u8 draw_font;
+    u32 vram_seq;           // bumped on every vram write
     chip8_cpu_t cpu;
-} chip8_state_t;
+    const u8 *decoded;
+    u16 code_dirty;
+    u32 rng;
+    u64 cycles;
+    u8 key_wait;
+    const chip8_native_block_t *const *native;
+    const u8 *breakpoints;
+};
+
+// read any state's memory, addresses wrap at 4K
+static inline u8 chip8_peek(const chip8_state_t *s, u16 addr)
+{
+    return s->page[(addr >> 8) & 0xF][addr & 0xFF];
+}
+
+// all calls below operate on the state selected for the calling thread.
+// states own their private pages, so they have to be zeroed or reset
+// before first use and released with chip8_release_state when done.
+// copies go through save and load, never plain assignment
+chip8_state_t *chip8_select_state(chip8_state_t *state);
+chip8_state_t *chip8_current_state();
+void chip8_save_state(chip8_state_t *dst);
+void chip8_load_state(const chip8_state_t *src);
+void chip8_restore_state(const chip8_state_t *src);
+void chip8_release_state();
+void chip8_seed_rng(u32 seed);
 
 void chip8_reset_state();
 int chip8_load_rom(const char *file);
+int chip8_load_rom_data(const u8 *data, u32 size);
+void chip8_write_mem(u16 addr, const u8 *data, u32 size);
+
+// instances of one ROM can share its pages through an image, which has
+// to outlive every state mapped to it
+void chip8_save_image(chip8_image_t *img);
+void chip8_map_image(const chip8_image_t *img);
 void chip8_execute_step();
 u8 *chip8_get_vram();
+void chip8_pack_vram(const u8 *vram, u8 *bits);
+u64 chip8_get_cycles();
+int chip8_sound_on();
+void chip8_set_decode_cache(const u8 *icodes);
+void chip8_set_native_blocks(const chip8_native_block_t *const *blocks);
+u32 chip8_execute_block();
+
+
+// reasons chip8_run returns for
+typedef enum {
+    CHIP8_RUN_BUDGET,       // the cycle budget is used up
+    CHIP8_RUN_FRAME,        // a 60 Hz frame boundary was crossed
+    CHIP8_RUN_VRAM,         // the screen was drawn to
+    CHIP8_RUN_SOUND,        // the sound timer started or stopped
+    CHIP8_RUN_KEY_WAIT,     // the cpu is parked until a key press
+    CHIP8_RUN_BREAKPOINT,   // pc reached a breakpoint
+} chip8_run_reason_t;
+
+// events chip8_run stops at besides the budget and key waits
+#define CHIP8_STOP_FRAME        0x01
+#define CHIP8_STOP_VRAM         0x02
+#define CHIP8_STOP_SOUND        0x04
+#define CHIP8_STOP_BREAKPOINT   0x08
+
+// run up to budget cycles, native blocks may overshoot it slightly.
+// cycles receives the number executed
+chip8_run_reason_t chip8_run(u32 budget, u32 stop, u32 *cycles);
+chip8_run_reason_t chip8_run_frame(u32 *cycles);
+
+// bitmap of 4096 pc addresses, checked by chip8_run with CHIP8_STOP_BREAKPOINT
+// before every instruction including the first
+void chip8_set_breakpoints(const u8 *bitmap);
+int chip8_decode_instruction(u16 opcode);
+int chip8_format_instruction(u16 opcode, char *buf, u32 size);
+void chip8_disassemble_instruction(u16 opcode);
 
 
 // keys
@@ -62,6 +169,7 @@ typedef enum {
 } chip8_keys_t;
 
 void chip8_key_event(chip8_keys_t key, u8 status);
+int chip8_waiting_key();
 
 // instructions
 
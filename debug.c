@@ -0,0 +1,282 @@
+/*
+ *  debug.c
+ *  chip8emu
+ *
+ *  Debugger: pc breakpoints, memory and index register watchpoints,
+ *  register conditions, single stepping and tracing.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "chip8.h"
+#include "debug.h"
+
+
+static int dbg_test(const u8 *bits, u32 addr)
+{
+    return addr < 4096 && (bits[addr >> 3] & (1 << (addr & 7)));
+}
+
+static void dbg_set(u8 *bits, u32 addr, int on)
+{
+    if (addr >= 4096)
+        return;
+
+    if (on)
+        bits[addr >> 3] |= 1 << (addr & 7);
+    else
+        bits[addr >> 3] &= ~(1 << (addr & 7));
+}
+
+void chip8_debug_init(chip8_debugger_t *dbg)
+{
+    assert(dbg);
+
+    memset(dbg, 0, sizeof(chip8_debugger_t));
+}
+
+void chip8_debug_break(chip8_debugger_t *dbg, u16 addr, int on)
+{
+    assert(dbg);
+
+    dbg_set(dbg->breakpoints, addr, on);
+}
+
+void chip8_debug_watch(chip8_debugger_t *dbg, u16 first, u16 last, int read, int write)
+{
+    assert(dbg);
+
+    for (u32 a = first; a <= last; a++) {
+        dbg_set(dbg->watch_read, a, read);
+        dbg_set(dbg->watch_write, a, write);
+    }
+}
+
+static int dbg_cond_true(const chip8_debug_cond_t *c, const chip8_cpu_t *cpu)
+{
+    u8 v = cpu->dreg[c->reg];
+
+    switch (c->op) {
+        case CHIP8_COND_EQ: return v == c->value;
+        case CHIP8_COND_NE: return v != c->value;
+        case CHIP8_COND_LT: return v < c->value;
+        case CHIP8_COND_GT: return v > c->value;
+    }
+
+    return 0;
+}
+
+int chip8_debug_condition(chip8_debugger_t *dbg, u8 reg, chip8_debug_op_t op, u8 value)
+{
+    assert(dbg);
+
+    if (dbg->nconds >= CHIP8_DEBUG_CONDITIONS || reg > 15)
+        return 0;
+
+    chip8_debug_cond_t *c = &dbg->conds[dbg->nconds++];
+
+    c->reg = reg;
+    c->op = op;
+    c->value = value;
+
+    // a condition that already holds only triggers once it changes again
+    c->held = dbg_cond_true(c, &chip8_current_state()->cpu);
+
+    return 1;
+}
+
+void chip8_debug_clear_conditions(chip8_debugger_t *dbg)
+{
+    assert(dbg);
+
+    dbg->nconds = 0;
+}
+
+
+// memory the instruction at pc is about to touch, in [first, last) before
+// wrapping at 4K like the accesses themselves
+static void dbg_access(const chip8_state_t *s, u16 opcode, u32 *first, u32 *last, int *write)
+{
+    u32 n = 0;
+
+    *write = 0;
+
+    switch (chip8_decode_instruction(opcode)) {
+        case I_SPRITE:
+            n = opcode & 0xF;
+            break;
+
+        case I_LDR:
+            n = (opcode & 0x0F00) >> 8;
+            break;
+
+        case I_STR:
+            n = (opcode & 0x0F00) >> 8;
+            *write = 1;
+            break;
+
+        case I_BCD:
+            n = 3;
+            *write = 1;
+            break;
+    }
+
+    *first = s->cpu.ireg;
+    *last = s->cpu.ireg + n;
+}
+
+static void dbg_trace(const chip8_state_t *s, u16 opcode)
+{
+    char text[32];
+
+    chip8_format_instruction(opcode, text, sizeof(text));
+    printf("%03x  %04x  %-20s i=%03x v0=%02x vf=%02x\n",
+           s->cpu.pc, opcode, text, s->cpu.ireg, s->cpu.dreg[0], s->cpu.dreg[15]);
+}
+
+// execute one instruction and report why to stop after it, if at all
+static chip8_debug_stop_t dbg_execute(chip8_debugger_t *dbg)
+{
+    chip8_state_t *s = chip8_current_state();
+    u16 pc = s->cpu.pc;
+    u16 ireg = s->cpu.ireg;
+    u16 opcode = (chip8_peek(s, pc) << 8) | chip8_peek(s, pc + 1);
+    u32 first, last;
+    int write;
+
+    if (s->key_wait)
+        return CHIP8_DBG_KEY_WAIT;
+
+    dbg_access(s, opcode, &first, &last, &write);
+
+    if (dbg->trace)
+        dbg_trace(s, opcode);
+
+    chip8_execute_step();
+
+    dbg->stop_pc = pc;
+
+    for (u32 a = first; a < last; a++) {
+        if (dbg_test(write ? dbg->watch_write : dbg->watch_read, a & 0xFFF)) {
+            dbg->stop_addr = a & 0xFFF;
+            return write ? CHIP8_DBG_WATCH_WRITE : CHIP8_DBG_WATCH_READ;
+        }
+    }
+
+    if (dbg->watch_ireg && s->cpu.ireg != ireg) {
+        dbg->stop_addr = s->cpu.ireg;
+        return CHIP8_DBG_WATCH_IREG;
+    }
+
+    chip8_debug_stop_t stop = CHIP8_DBG_NONE;
+
+    // update every condition so each edge is seen exactly once
+    for (u32 i = 0; i < dbg->nconds; i++) {
+        chip8_debug_cond_t *c = &dbg->conds[i];
+        int now = dbg_cond_true(c, &s->cpu);
+
+        if (now && !c->held && stop == CHIP8_DBG_NONE) {
+            dbg->stop_addr = c->reg;
+            stop = CHIP8_DBG_CONDITION;
+        }
+
+        c->held = now;
+    }
+
+    return stop;
+}
+
+// anything beyond breakpoints needs each instruction looked at
+static int dbg_checks_accesses(const chip8_debugger_t *dbg)
+{
+    if (dbg->trace || dbg->watch_ireg || dbg->nconds)
+        return 1;
+
+    for (u32 i = 0; i < sizeof(dbg->watch_read); i++)
+        if (dbg->watch_read[i] | dbg->watch_write[i])
+            return 1;
+
+    return 0;
+}
+
+chip8_debug_stop_t chip8_debug_step(chip8_debugger_t *dbg)
+{
+    assert(dbg);
+
+    chip8_debug_stop_t stop = dbg_execute(dbg);
+
+    return stop == CHIP8_DBG_NONE ? CHIP8_DBG_STEP : stop;
+}
+
+static chip8_debug_stop_t dbg_break(chip8_debugger_t *dbg, const chip8_state_t *s)
+{
+    dbg->stop_pc = dbg->stop_addr = s->cpu.pc;
+    dbg->on_break = 1;
+    dbg->break_cycles = s->cycles;
+
+    return CHIP8_DBG_BREAKPOINT;
+}
+
+// run until something triggers or max_cycles instructions have executed.
+// only the breakpoint the last continue stopped on is stepped over, one
+// on a pc reached any other way stops right away
+chip8_debug_stop_t chip8_debug_continue(chip8_debugger_t *dbg, u64 max_cycles)
+{
+    chip8_state_t *s = chip8_current_state();
+
+    assert(dbg);
+
+    int resume = dbg->on_break && s->cpu.pc == dbg->stop_pc && s->cycles == dbg->break_cycles;
+
+    dbg->on_break = 0;
+
+    if (resume && max_cycles > 0) {
+        chip8_debug_stop_t stop = dbg_execute(dbg);
+
+        if (stop != CHIP8_DBG_NONE)
+            return stop;
+
+        max_cycles--;
+    }
+
+    // with only breakpoints set the core's run loop can check them itself
+    if (!dbg_checks_accesses(dbg)) {
+        chip8_set_breakpoints(dbg->breakpoints);
+
+        while (max_cycles > 0) {
+            u32 budget = max_cycles < 0x10000000 ? max_cycles : 0x10000000;
+            u32 cycles;
+            chip8_run_reason_t reason = chip8_run(budget, CHIP8_STOP_BREAKPOINT, &cycles);
+
+            max_cycles -= cycles < max_cycles ? cycles : max_cycles;
+
+            if (reason == CHIP8_RUN_BREAKPOINT) {
+                chip8_set_breakpoints(0);
+                return dbg_break(dbg, s);
+            }
+
+            if (reason == CHIP8_RUN_KEY_WAIT) {
+                chip8_set_breakpoints(0);
+                return CHIP8_DBG_KEY_WAIT;
+            }
+        }
+
+        chip8_set_breakpoints(0);
+        return CHIP8_DBG_NONE;
+    }
+
+    for (u64 n = 0; n < max_cycles; n++) {
+        if (dbg_test(dbg->breakpoints, s->cpu.pc))
+            return dbg_break(dbg, s);
+
+        chip8_debug_stop_t stop = dbg_execute(dbg);
+
+        if (stop != CHIP8_DBG_NONE)
+            return stop;
+    }
+
+    return CHIP8_DBG_NONE;
+}
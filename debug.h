@@ -0,0 +1,74 @@
+/*
+ *  debug.h
+ *  chip8emu
+ *
+ *  Debugger: pc breakpoints, memory and index register watchpoints,
+ *  register conditions, single stepping and tracing. It drives the
+ *  interpreter itself, so the core's own step loop carries no checks
+ *  and runs at full speed whenever no debugger is in use.
+ *
+ */
+
+#ifndef DEBUG_H
+#define DEBUG_H
+
+#include "chip8.h"
+
+
+typedef enum {
+    CHIP8_DBG_NONE,
+    CHIP8_DBG_STEP,
+    CHIP8_DBG_BREAKPOINT,
+    CHIP8_DBG_WATCH_READ,
+    CHIP8_DBG_WATCH_WRITE,
+    CHIP8_DBG_WATCH_IREG,
+    CHIP8_DBG_CONDITION,
+    CHIP8_DBG_KEY_WAIT,
+} chip8_debug_stop_t;
+
+typedef enum {
+    CHIP8_COND_EQ,
+    CHIP8_COND_NE,
+    CHIP8_COND_LT,
+    CHIP8_COND_GT,
+} chip8_debug_op_t;
+
+#define CHIP8_DEBUG_CONDITIONS 8
+
+typedef struct {
+    u8 reg;
+    u8 op;
+    u8 value;
+    u8 held;        // true after the last instruction, conditions trigger on edges
+} chip8_debug_cond_t;
+
+typedef struct {
+    u8 breakpoints[4096 / 8];
+    u8 watch_read[4096 / 8];
+    u8 watch_write[4096 / 8];
+    u8 watch_ireg;
+    chip8_debug_cond_t conds[CHIP8_DEBUG_CONDITIONS];
+    u32 nconds;
+    u8 trace;
+
+    // where the last stop happened
+    u16 stop_pc;
+    u16 stop_addr;
+    // stopped on the breakpoint at stop_pc after break_cycles, the next
+    // continue from there executes that instruction before checking
+    u8 on_break;
+    u64 break_cycles;
+} chip8_debugger_t;
+
+void chip8_debug_init(chip8_debugger_t *dbg);
+
+void chip8_debug_break(chip8_debugger_t *dbg, u16 addr, int on);
+void chip8_debug_watch(chip8_debugger_t *dbg, u16 first, u16 last, int read, int write);
+int chip8_debug_condition(chip8_debugger_t *dbg, u8 reg, chip8_debug_op_t op, u8 value);
+void chip8_debug_clear_conditions(chip8_debugger_t *dbg);
+
+chip8_debug_stop_t chip8_debug_step(chip8_debugger_t *dbg);
+chip8_debug_stop_t chip8_debug_continue(chip8_debugger_t *dbg, u64 max_cycles);
+
+
+#endif // DEBUG_H
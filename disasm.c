@@ -0,0 +1,375 @@
+/*
+ *  disasm.c
+ *  chip8emu
+ *
+ *  Whole-ROM disassembler: recovers basic blocks, subroutines, jmi jump
+ *  tables and data regions and renders listings or a DOT control flow
+ *  graph into caller-provided buffers.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <assert.h>
+
+#include "chip8.h"
+#include "disasm.h"
+
+
+// jump tables longer than this are assumed to be misdetected
+#define MAX_TABLE 128
+
+
+static u16 dis_opcode(const chip8_disasm_t *d, u16 addr)
+{
+    int i = addr - CHIP8_PROG_START;
+
+    return (d->mem[i] << 8) | d->mem[i+1];
+}
+
+static u8 dis_code_flags(const chip8_disasm_t *d, u16 addr)
+{
+    if (addr < CHIP8_PROG_START || addr >= 4095)
+        return 0;
+
+    return d->code.flags[addr - CHIP8_PROG_START];
+}
+
+static int dis_is_code(const chip8_disasm_t *d, u16 addr)
+{
+    return dis_code_flags(d, addr) & CHIP8_TC_CODE;
+}
+
+static int dis_icode(const chip8_disasm_t *d, u16 addr)
+{
+    return d->code.icode[addr - CHIP8_PROG_START];
+}
+
+
+// analysis
+
+// jmi tables are runs of jumps indexed by v0, walk each entry as code
+static int dis_recover_tables(chip8_disasm_t *d, u8 *seen)
+{
+    int found = 0;
+
+    for (u16 pc = CHIP8_PROG_START; pc < 4095; pc++) {
+        if (!dis_is_code(d, pc) || dis_icode(d, pc) != I_JMI || seen[pc - CHIP8_PROG_START])
+            continue;
+
+        seen[pc - CHIP8_PROG_START] = 1;
+        d->tables++;
+
+        u16 base = dis_opcode(d, pc) & 0xFFF;
+
+        for (u16 a = base, n = 0; a >= CHIP8_PROG_START && a < 4095 && n < MAX_TABLE; a += 2, n++) {
+            if (dis_icode(d, a) != I_JMP)
+                break;
+
+            if (!dis_is_code(d, a)) {
+                chip8_tcache_walk(&d->code, d->mem, a, CHIP8_TC_TABLE);
+                found = 1;
+            } else
+                d->code.flags[a - CHIP8_PROG_START] |= CHIP8_TC_TABLE | CHIP8_TC_LEADER;
+        }
+    }
+
+    return found;
+}
+
+void chip8_disasm_analyze(const u8 *rom, u32 size, chip8_disasm_t *d)
+{
+    u8 seen[CHIP8_PROG_SIZE];
+    u8 covered[CHIP8_PROG_SIZE + 1];
+
+    assert(rom && d && size <= CHIP8_PROG_SIZE);
+
+    memset(d, 0, sizeof(chip8_disasm_t));
+    memcpy(d->mem, rom, size);
+    d->size = size;
+
+    chip8_tcache_analyze(rom, size, &d->code);
+
+    // tables can lead to more jmi, repeat until nothing new turns up
+    memset(seen, 0, sizeof(seen));
+    while (dis_recover_tables(d, seen))
+        ;
+
+    memset(covered, 0, sizeof(covered));
+
+    for (u16 pc = CHIP8_PROG_START; pc < 4095; pc++) {
+        u8 f = dis_code_flags(d, pc);
+        int i = pc - CHIP8_PROG_START;
+
+        if (!(f & CHIP8_TC_CODE))
+            continue;
+
+        covered[i] = covered[i+1] = 1;
+
+        if (f & CHIP8_TC_LEADER)
+            d->blocks++;
+        if (f & CHIP8_TC_SUBROUTINE)
+            d->subroutines++;
+
+        // index register loads point at sprites and other data
+        if (dis_icode(d, pc) == I_MVI) {
+            u16 target = dis_opcode(d, pc) & 0xFFF;
+
+            if (target >= CHIP8_PROG_START)
+                d->flags[target - CHIP8_PROG_START] |= CHIP8_DIS_DATAREF;
+        }
+    }
+
+    for (u32 i = 0; i < size; i++)
+        if (!covered[i])
+            d->flags[i] |= CHIP8_DIS_DATA;
+}
+
+
+// output
+
+typedef struct {
+    char *buf;
+    u32 size;
+    u32 len;
+} dis_out_t;
+
+static void dis_printf(dis_out_t *o, const char *fmt, ...)
+{
+    va_list ap;
+    u32 room = o->len < o->size ? o->size - o->len : 0;
+
+    va_start(ap, fmt);
+    int n = vsnprintf(room ? o->buf + o->len : 0, room, fmt, ap);
+    va_end(ap);
+
+    if (n > 0)
+        o->len += n;
+}
+
+// data bytes are the bulk of most listings, skip the printf machinery
+static void dis_hex_byte(dis_out_t *o, u8 v, int first)
+{
+    static const char digits[] = "0123456789abcdef";
+    char text[6] = { ',', ' ', '0', 'x', digits[v >> 4], digits[v & 0xF] };
+    const char *p = first ? text + 2 : text;
+    u32 n = first ? 4 : 6;
+
+    for (u32 i = 0; i < n; i++, o->len++)
+        if (o->len < o->size)
+            o->buf[o->len] = p[i];
+
+    // keep the output terminated like vsnprintf would
+    if (o->size)
+        o->buf[o->len < o->size ? o->len : o->size - 1] = 0;
+}
+
+// label for an address, or 0 if nothing refers to it
+static const char *dis_label(const chip8_disasm_t *d, u16 addr, char *buf, u32 size)
+{
+    u8 f = dis_code_flags(d, addr);
+
+    if (f & CHIP8_TC_CODE) {
+        if (f & CHIP8_TC_SUBROUTINE)
+            snprintf(buf, size, "sub_%03x", addr);
+        else if (f & CHIP8_TC_TABLE)
+            snprintf(buf, size, "case_%03x", addr);
+        else if (f & (CHIP8_TC_JUMP | CHIP8_TC_LEADER))
+            snprintf(buf, size, "L_%03x", addr);
+        else
+            return 0;
+        return buf;
+    }
+
+    if (addr >= CHIP8_PROG_START && addr < 4096 && (d->flags[addr - CHIP8_PROG_START] & CHIP8_DIS_DATAREF)) {
+        snprintf(buf, size, "data_%03x", addr);
+        return buf;
+    }
+
+    return 0;
+}
+
+static int dis_is_terminator(int icode)
+{
+    switch (icode) {
+        case I_JMP:
+        case I_JSR:
+        case I_RTS:
+        case I_JMI:
+        case I_SKEQI:
+        case I_SKNEI:
+        case I_SKEQ:
+        case I_SKNE:
+        case I_SKPR:
+        case I_SKUP:
+        case I_UNKNOWN:
+            return 1;
+    }
+
+    return 0;
+}
+
+// last instruction of the block starting at start
+static u16 dis_block_end(const chip8_disasm_t *d, u16 start)
+{
+    u16 pc = start;
+
+    while (!dis_is_terminator(dis_icode(d, pc))) {
+        u8 next = dis_code_flags(d, pc + 2);
+
+        if (!(next & CHIP8_TC_CODE) || (next & CHIP8_TC_LEADER))
+            break;
+
+        pc += 2;
+    }
+
+    return pc;
+}
+
+static void dis_instruction(const chip8_disasm_t *d, dis_out_t *o, u16 pc, const char *eol)
+{
+    u16 opcode = dis_opcode(d, pc);
+    char text[32], name[16];
+    const char *label = 0;
+
+    chip8_format_instruction(opcode, text, sizeof(text));
+
+    switch (dis_icode(d, pc)) {
+        case I_JMP:
+        case I_JSR:
+        case I_MVI:
+        case I_JMI:
+            label = dis_label(d, opcode & 0xFFF, name, sizeof(name));
+            break;
+    }
+
+    if (label)
+        dis_printf(o, "%03x  %04x  %-20s ; %s%s", pc, opcode, text, label, eol);
+    else
+        dis_printf(o, "%03x  %04x  %s%s", pc, opcode, text, eol);
+}
+
+u32 chip8_disasm_listing(const chip8_disasm_t *d, char *buf, u32 size)
+{
+    dis_out_t o = { buf, size, 0 };
+    char name[16];
+    u32 end = CHIP8_PROG_START + d->size;
+
+    // code may run past the image into zeroed memory
+    for (u16 pc = end; pc < 4095; pc++)
+        if (dis_is_code(d, pc))
+            end = pc + 2;
+
+    dis_printf(&o, "; %u bytes, %u blocks, %u subroutines, %u jump tables\n",
+               d->size, d->blocks, d->subroutines, d->tables);
+
+    for (u32 pc = CHIP8_PROG_START; pc < end; ) {
+        const char *label = dis_label(d, pc, name, sizeof(name));
+
+        if (label)
+            dis_printf(&o, "\n%s:\n", label);
+
+        if (dis_is_code(d, pc)) {
+            dis_printf(&o, "    ");
+            dis_instruction(d, &o, pc, "\n");
+            pc += 2;
+            continue;
+        }
+
+        if (!(d->flags[pc - CHIP8_PROG_START] & CHIP8_DIS_DATA)) {
+            // second byte of an instruction that also starts one byte later
+            pc++;
+            continue;
+        }
+
+        // up to eight data bytes, split at labels and code
+        dis_printf(&o, "    %03x        db ", pc);
+
+        for (int n = 0; n < 8 && pc < end; n++) {
+            dis_hex_byte(&o, d->mem[pc - CHIP8_PROG_START], n == 0);
+            pc++;
+
+            if (pc >= end || !(d->flags[pc - CHIP8_PROG_START] & CHIP8_DIS_DATA) ||
+                dis_label(d, pc, name, sizeof(name)))
+                break;
+        }
+
+        dis_printf(&o, "\n");
+    }
+
+    return o.len;
+}
+
+static void dis_edge(const chip8_disasm_t *d, dis_out_t *o, u16 from, u16 to, const char *style)
+{
+    if (!dis_is_code(d, to))
+        return;
+
+    dis_printf(o, "    b_%03x -> b_%03x%s;\n", from, to, style);
+}
+
+u32 chip8_disasm_dot(const chip8_disasm_t *d, char *buf, u32 size)
+{
+    dis_out_t o = { buf, size, 0 };
+    char name[16];
+
+    dis_printf(&o, "digraph chip8 {\n    node [shape=box, fontname=\"monospace\"];\n");
+
+    for (u16 start = CHIP8_PROG_START; start < 4095; start++) {
+        u8 f = dis_code_flags(d, start);
+
+        if ((f & (CHIP8_TC_CODE | CHIP8_TC_LEADER)) != (CHIP8_TC_CODE | CHIP8_TC_LEADER))
+            continue;
+
+        u16 last = dis_block_end(d, start);
+        const char *label = dis_label(d, start, name, sizeof(name));
+
+        dis_printf(&o, "    b_%03x [label=\"%s:\\l", start, label ? label : "");
+        for (u16 pc = start; pc <= last; pc += 2)
+            dis_instruction(d, &o, pc, "\\l");
+        dis_printf(&o, "\"];\n");
+
+        u16 opcode = dis_opcode(d, last);
+        u16 target = opcode & 0xFFF;
+
+        switch (dis_icode(d, last)) {
+            case I_JMP:
+                dis_edge(d, &o, start, target, "");
+                break;
+
+            case I_JSR:
+                dis_edge(d, &o, start, target, " [style=dashed]");
+                dis_edge(d, &o, start, last + 2, "");
+                break;
+
+            case I_SKEQI:
+            case I_SKNEI:
+            case I_SKEQ:
+            case I_SKNE:
+            case I_SKPR:
+            case I_SKUP:
+                dis_edge(d, &o, start, last + 2, "");
+                dis_edge(d, &o, start, last + 4, " [label=skip]");
+                break;
+
+            case I_JMI:
+                for (u16 a = target; (dis_code_flags(d, a) & CHIP8_TC_TABLE); a += 2)
+                    dis_edge(d, &o, start, a, " [style=dotted]");
+                break;
+
+            case I_RTS:
+            case I_UNKNOWN:
+                break;
+
+            default:
+                dis_edge(d, &o, start, last + 2, "");
+                break;
+        }
+    }
+
+    dis_printf(&o, "}\n");
+
+    return o.len;
+}
@@ -0,0 +1,40 @@
+/*
+ *  disasm.h
+ *  chip8emu
+ *
+ *  Whole-ROM disassembler: recovers basic blocks, subroutines, jmi jump
+ *  tables and data regions and renders listings or a DOT control flow
+ *  graph into caller-provided buffers.
+ *
+ */
+
+#ifndef DISASM_H
+#define DISASM_H
+
+#include "chip8.h"
+#include "tcache.h"
+
+
+// per address flags on top of the CHIP8_TC_* ones
+#define CHIP8_DIS_DATA      0x01    // not covered by any reachable instruction
+#define CHIP8_DIS_DATAREF   0x02    // loaded into the index register by mvi
+
+
+typedef struct {
+    u8 mem[CHIP8_PROG_SIZE + 1];
+    u32 size;
+    chip8_tcache_data_t code;
+    u8 flags[CHIP8_PROG_SIZE];
+    u32 blocks;
+    u32 subroutines;
+    u32 tables;
+} chip8_disasm_t;
+
+void chip8_disasm_analyze(const u8 *rom, u32 size, chip8_disasm_t *d);
+
+// both return the full length like snprintf, output is truncated to size
+u32 chip8_disasm_listing(const chip8_disasm_t *d, char *buf, u32 size);
+u32 chip8_disasm_dot(const chip8_disasm_t *d, char *buf, u32 size);
+
+
+#endif // DISASM_H
@@ -0,0 +1,224 @@
+/*
+ *  env.c
+ *  chip8emu
+ *
+ *  Batched environments for agent training.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "chip8.h"
+#include "env.h"
+#include "tcache.h"
+
+
+int chip8_env_init(chip8_env_t *env, u32 count, const u8 *rom, u32 size, u32 boot_frames)
+{
+    assert(env && rom && count);
+
+    memset(env, 0, sizeof(chip8_env_t));
+    env->count = count;
+    env->obs = CHIP8_ENV_OBS_BYTES;
+    env->frame_cycles = CHIP8_CYCLES_PER_FRAME;
+
+    chip8_state_t *prev = chip8_select_state(&env->boot);
+
+    chip8_reset_state();
+    int ok = chip8_load_rom_data(rom, size);
+
+    // a warm start maps the analysis an earlier run left in the cache
+    if (ok) {
+        char dir[4096];
+
+        env->tcache = chip8_tcache_open(chip8_tcache_dir(dir, sizeof(dir)), rom, size);
+        chip8_tcache_attach(env->tcache);
+    }
+
+    for (u32 f = 0; ok && f < boot_frames; f++)
+        chip8_run(env->frame_cycles, 0, 0);
+
+    if (ok && (env->image = malloc(sizeof(chip8_image_t))) != 0) {
+        // pages booting wrote to keep decoding from memory
+        u16 dirty = env->boot.code_dirty;
+
+        chip8_save_image(env->image);
+        chip8_map_image(env->image);
+        chip8_tcache_attach(env->tcache);
+        env->boot.code_dirty = dirty;
+    }
+
+    chip8_select_state(prev);
+
+    env->instances = calloc(count, sizeof(chip8_env_instance_t));
+
+    if (!ok || !env->image || !env->instances) {
+        chip8_env_free(env);
+        return 0;
+    }
+
+    // start every instance off done so the first step restores it
+    for (u32 i = 0; i < count; i++)
+        env->instances[i].done = 1;
+
+    return 1;
+}
+
+void chip8_env_free(chip8_env_t *env)
+{
+    assert(env);
+
+    chip8_state_t *prev = chip8_current_state();
+
+    for (u32 i = 0; env->instances && i < env->count; i++) {
+        chip8_select_state(&env->instances[i].state);
+        chip8_release_state();
+    }
+
+    chip8_select_state(&env->boot);
+    chip8_release_state();
+    chip8_select_state(prev);
+
+    free(env->instances);
+    free(env->image);
+    chip8_tcache_close(env->tcache);
+    env->instances = 0;
+    env->image = 0;
+    env->tcache = 0;
+}
+
+int chip8_env_add_reward(chip8_env_t *env, u16 addr, s16 weight)
+{
+    assert(env);
+
+    if (env->nrewards >= CHIP8_ENV_REWARDS || addr >= 4096)
+        return 0;
+
+    env->rewards[env->nrewards].addr = addr;
+    env->rewards[env->nrewards].weight = weight;
+    env->nrewards++;
+
+    return 1;
+}
+
+void chip8_env_set_done(chip8_env_t *env, u16 addr, u8 value)
+{
+    assert(env);
+
+    env->done_addr = addr & 0xFFF;
+    env->done_value = value;
+    env->has_done = 1;
+}
+
+u32 chip8_env_obs_size(const chip8_env_t *env)
+{
+    return env->obs == CHIP8_ENV_OBS_BITS ? CHIP8_ENV_OBS_BITS_SIZE : CHIP8_ENV_OBS_BYTES_SIZE;
+}
+
+
+static void env_write_obs(const chip8_env_t *env, const chip8_state_t *s, u8 *out)
+{
+    if (env->obs == CHIP8_ENV_OBS_BYTES) {
+        memcpy(out, s->vram, CHIP8_ENV_OBS_BYTES_SIZE);
+        return;
+    }
+
+    chip8_pack_vram(s->vram, out);
+}
+
+static void env_restore(chip8_env_t *env, u32 index)
+{
+    chip8_env_instance_t *inst = &env->instances[index];
+
+    chip8_load_state(&env->boot);
+
+    // every episode plays out differently but reproducibly
+    chip8_seed_rng(env->seed ^ (index * 0x9E3779B1u) ^ (inst->episode * 0x85EBCA77u));
+
+    for (u32 r = 0; r < env->nrewards; r++)
+        inst->last[r] = chip8_peek(&env->boot, env->rewards[r].addr);
+
+    inst->frames = 0;
+    inst->key = CHIP8_ENV_NOOP;
+    inst->done = 0;
+    inst->episode++;
+}
+
+void chip8_env_reset(chip8_env_t *env, u8 *obs)
+{
+    assert(env);
+
+    u32 size = chip8_env_obs_size(env);
+    chip8_state_t *prev = chip8_current_state();
+
+    for (u32 i = 0; i < env->count; i++) {
+        chip8_select_state(&env->instances[i].state);
+        env_restore(env, i);
+
+        if (obs)
+            env_write_obs(env, &env->instances[i].state, obs + i * size);
+    }
+
+    chip8_select_state(prev);
+}
+
+void chip8_env_step_range(chip8_env_t *env, u32 first, u32 count,
+                          const u8 *actions, u8 *obs, float *rewards, u8 *done)
+{
+    assert(env && actions && first + count <= env->count);
+
+    u32 size = chip8_env_obs_size(env);
+    chip8_state_t *prev = chip8_current_state();
+
+    for (u32 i = first; i < first + count; i++) {
+        chip8_env_instance_t *inst = &env->instances[i];
+        chip8_state_t *s = &inst->state;
+        u8 action = actions[i];
+
+        chip8_select_state(s);
+
+        if (inst->done)
+            env_restore(env, i);
+
+        // a held key is pressed again every frame so it also wakes key
+        if (inst->key != CHIP8_ENV_NOOP && inst->key != action)
+            chip8_key_event(inst->key, 0);
+        if (action != CHIP8_ENV_NOOP)
+            chip8_key_event(action & 0xF, 1);
+        inst->key = action == CHIP8_ENV_NOOP ? action : action & 0xF;
+
+        // parked cpus sit out the rest of the frame
+        chip8_run(env->frame_cycles, 0, 0);
+        inst->frames++;
+
+        if (obs)
+            env_write_obs(env, s, obs + i * size);
+
+        s32 reward = 0;
+
+        for (u32 r = 0; r < env->nrewards; r++) {
+            u8 v = chip8_peek(s, env->rewards[r].addr);
+
+            reward += env->rewards[r].weight * ((s32)v - inst->last[r]);
+            inst->last[r] = v;
+        }
+
+        if (rewards)
+            rewards[i] = reward;
+
+        inst->done = (env->has_done && chip8_peek(s, env->done_addr) == env->done_value) ||
+                     (env->max_frames && inst->frames >= env->max_frames);
+
+        if (done)
+            done[i] = inst->done;
+    }
+
+    chip8_select_state(prev);
+}
+
+void chip8_env_step(chip8_env_t *env, const u8 *actions, u8 *obs, float *rewards, u8 *done)
+{
+    chip8_env_step_range(env, 0, env->count, actions, obs, rewards, done);
+}
@@ -0,0 +1,92 @@
+/*
+ *  env.h
+ *  chip8emu
+ *
+ *  Batched environments for agent training: many instances of one ROM
+ *  advance a frame per step, writing observations, rewards and done
+ *  flags straight into caller-owned arrays.
+ *
+ */
+
+#ifndef ENV_H
+#define ENV_H
+
+#include "chip8.h"
+#include "tcache.h"
+
+
+typedef enum {
+    CHIP8_ENV_OBS_BYTES,    // one byte per pixel, 0 or 1
+    CHIP8_ENV_OBS_BITS,     // eight pixels per byte, leftmost in the top bit
+} chip8_env_obs_t;
+
+#define CHIP8_ENV_OBS_BYTES_SIZE (64*32)
+#define CHIP8_ENV_OBS_BITS_SIZE (64*32 / 8)
+
+// action for frames without a key held
+#define CHIP8_ENV_NOOP 0xFF
+
+#define CHIP8_ENV_REWARDS 8
+
+// reward is the weighted change of the byte at addr since the last step
+typedef struct {
+    u16 addr;
+    s16 weight;
+} chip8_env_reward_t;
+
+typedef struct {
+    chip8_state_t state;
+    u8 last[CHIP8_ENV_REWARDS];
+    u32 frames;
+    u32 episode;
+    u8 key;
+    u8 done;
+} chip8_env_instance_t;
+
+typedef struct {
+    u32 count;
+    chip8_env_obs_t obs;
+    u32 frame_cycles;
+    u32 max_frames;         // episodes are cut off after this many, 0 for no limit
+    u32 seed;
+
+    chip8_env_reward_t rewards[CHIP8_ENV_REWARDS];
+    u32 nrewards;
+
+    // an episode ends once mem[done_addr] == done_value
+    u16 done_addr;
+    u8 done_value;
+    u8 has_done;
+
+    // memory after booting, shared by all instances until they write to it
+    chip8_image_t *image;
+    chip8_tcache_t *tcache;     // decode cache every instance runs from
+    chip8_state_t boot;
+    chip8_env_instance_t *instances;
+} chip8_env_t;
+
+// boots the ROM for boot_frames frames and keeps that as the reset state
+int chip8_env_init(chip8_env_t *env, u32 count, const u8 *rom, u32 size, u32 boot_frames);
+void chip8_env_free(chip8_env_t *env);
+
+int chip8_env_add_reward(chip8_env_t *env, u16 addr, s16 weight);
+void chip8_env_set_done(chip8_env_t *env, u16 addr, u8 value);
+
+u32 chip8_env_obs_size(const chip8_env_t *env);
+
+// restores every instance, obs may be 0
+void chip8_env_reset(chip8_env_t *env, u8 *obs);
+
+// actions holds a key or CHIP8_ENV_NOOP per instance, the outputs hold
+// count entries each with obs at chip8_env_obs_size bytes per instance.
+// instances that reported done restart from the boot state on their
+// next step
+void chip8_env_step(chip8_env_t *env, const u8 *actions, u8 *obs, float *rewards, u8 *done);
+
+// steps instances [first, first+count) only, so callers can split a
+// batch across threads. outputs are indexed by instance like above
+void chip8_env_step_range(chip8_env_t *env, u32 first, u32 count,
+                          const u8 *actions, u8 *obs, float *rewards, u8 *done);
+
+
+#endif // ENV_H
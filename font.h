@@ -10,104 +10,48 @@
 #ifndef FONT_H
 #define FONT_H
 
-u8 chip8_font4x5[16][20] =
+// hex digits, 4x5 pixels in the top bits of 5 bytes each. copied to
+// CHIP8_FONT_ADDR on reset
+static const u8 chip8_font[16 * 5] =
 {
-// 0
- {0,1,1,0,
-  1,0,0,1,
-  1,0,0,1,
-  1,0,0,1,
-  0,1,1,0},
-// 1
- {0,0,0,1,
-  0,0,1,1,
-  0,0,0,1,
-  0,0,0,1,
-  0,0,0,1},
-// 2
- {0,1,1,0,
-  1,0,0,1,
-  0,0,1,0,
-  0,1,0,0,
-  1,1,1,1},
-// 3
- {0,1,1,0,
-  1,0,0,1,
-  0,0,1,0,
-  1,0,0,1,
-  0,1,1,0},
-// 4
- {1,0,0,1,
-  1,0,0,1,
-  1,1,1,1,
-  0,0,0,1,
-  0,0,0,1},
-// 5
- {1,1,1,1,
-  1,0,0,0,
-  1,1,1,1,
-  0,0,0,1,
-  1,1,1,1},
-// 6
- {1,1,1,1,
-  1,0,0,0,
-  1,1,1,1,
-  1,0,0,1,
-  1,1,1,1},
-// 7
- {1,1,1,1,
-  0,0,0,1,
-  0,0,1,0,
-  0,1,0,0,
-  1,0,0,0},
-// 8
- {1,1,1,1,
-  1,0,0,1,
-  1,1,1,1,
-  1,0,0,1,
-  1,1,1,1},
-// 9
- {1,1,1,1,
-  1,0,0,1,
-  1,1,1,1,
-  0,0,0,1,
-  1,1,1,1},
-// A
- {0,1,1,0,
-  1,0,0,1,
-  1,1,1,1,
-  1,0,0,1,
-  1,0,0,1},
-// B
- {1,1,1,0,
-  1,0,0,1,
-  1,1,1,0,
-  1,0,0,1,
-  1,1,1,0},
-// C
- {0,1,1,1,
-  1,0,0,0,
-  1,0,0,0,
-  1,0,0,0,
-  0,1,1,1},
-// D
- {1,1,1,0,
-  1,0,0,1,
-  1,0,0,1,
-  1,0,0,1,
-  1,1,1,0},
-// E
- {1,1,1,1,
-  1,0,0,0,
-  1,1,1,0,
-  1,0,0,0,
-  1,1,1,1},
-// F
- {1,1,1,1,
-  1,0,0,0,
-  1,1,1,0,
-  1,0,0,0,
-  1,0,0,0}
+    0xF0, 0x90, 0x90, 0x90, 0xF0,   // 0
+    0x20, 0x60, 0x20, 0x20, 0x70,   // 1
+    0xF0, 0x10, 0xF0, 0x80, 0xF0,   // 2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0,   // 3
+    0x90, 0x90, 0xF0, 0x10, 0x10,   // 4
+    0xF0, 0x80, 0xF0, 0x10, 0xF0,   // 5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0,   // 6
+    0xF0, 0x10, 0x20, 0x40, 0x40,   // 7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0,   // 8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0,   // 9
+    0xF0, 0x90, 0xF0, 0x90, 0x90,   // A
+    0xE0, 0x90, 0xE0, 0x90, 0xE0,   // B
+    0xF0, 0x80, 0x80, 0x80, 0xF0,   // C
+    0xE0, 0x90, 0x90, 0x90, 0xE0,   // D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0,   // E
+    0xF0, 0x80, 0xF0, 0x80, 0x80,   // F
 };
 
-#endif // FONT_H
\ No newline at end of file
+// SCHIP big hex digits, 8x10 pixels in 10 bytes each. copied to
+// CHIP8_BIG_FONT_ADDR on reset
+static const u8 chip8_big_font[16 * 10] =
+{
+    0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C,   // 0
+    0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C,   // 1
+    0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF,   // 2
+    0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C,   // 3
+    0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06,   // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C,   // 5
+    0x3E, 0x7C, 0xC0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C,   // 6
+    0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60,   // 7
+    0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C,   // 8
+    0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C,   // 9
+    0x18, 0x3C, 0x66, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3,   // A
+    0xFC, 0xFE, 0xC3, 0xC3, 0xFE, 0xFE, 0xC3, 0xC3, 0xFE, 0xFC,   // B
+    0x3C, 0x7E, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0x7E, 0x3C,   // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC,   // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFC, 0xC0, 0xC0, 0xFF, 0xFF,   // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFC, 0xC0, 0xC0, 0xC0, 0xC0,   // F
+};
+
+#endif // FONT_H
@@ -0,0 +1,273 @@
+/*
+ *  framesrv.c
+ *  chip8emu
+ *
+ *  Shared memory frame server for local viewers.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "framesrv.h"
+
+
+#define FS_VERSION 1
+
+
+static void fs_names(chip8_framesrv_t *fs, const char *name)
+{
+    const char *tmp = getenv("TMPDIR");
+
+    snprintf(fs->name, sizeof(fs->name), "/chip8-%s", name);
+    snprintf(fs->sock_path, sizeof(fs->sock_path), "%s/chip8-%s.sock", tmp ? tmp : "/tmp", name);
+}
+
+static u32 fs_size(u32 instances)
+{
+    return sizeof(chip8_frame_shm_t) + instances * sizeof(chip8_frame_ring_t);
+}
+
+static void fs_addr(const chip8_framesrv_t *fs, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    snprintf(addr->sun_path, sizeof(addr->sun_path), "%s", fs->sock_path);
+}
+
+static void fs_wake(u32 *word)
+{
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAKE, 0x7FFFFFFF, 0, 0, 0);
+#else
+    (void)word;
+#endif
+}
+
+
+// server
+
+int chip8_framesrv_create(chip8_framesrv_t *fs, const char *name, u32 instances)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    assert(fs && name && instances);
+
+    memset(fs, 0, sizeof(chip8_framesrv_t));
+    fs_names(fs, name);
+    fs->size = fs_size(instances);
+    fs->owner = 1;
+    fs->sock = -1;
+
+    // start from a fresh segment, viewers of an old one keep their mapping
+    shm_unlink(fs->name);
+
+    if ((fd = shm_open(fs->name, O_CREAT | O_EXCL | O_RDWR, 0600)) < 0)
+        return 0;
+
+    if (ftruncate(fd, fs->size) != 0 ||
+        (fs->shm = mmap(0, fs->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        fs->shm = 0;
+        close(fd);
+        shm_unlink(fs->name);
+        return 0;
+    }
+
+    close(fd);
+
+    fs->shm->version = FS_VERSION;
+    fs->shm->instances = instances;
+    fs->shm->slots = CHIP8_FS_SLOTS;
+    // viewers that map the segment before this reject it
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(fs->shm->magic, "C8FS", 4);
+
+    fs_addr(fs, &addr);
+    unlink(fs->sock_path);
+
+    if ((fs->sock = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0 ||
+        bind(fs->sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        fcntl(fs->sock, F_SETFL, O_NONBLOCK) != 0) {
+        chip8_framesrv_close(fs);
+        return 0;
+    }
+
+    return 1;
+}
+
+void chip8_framesrv_publish(chip8_framesrv_t *fs, u32 instance, const u8 *vram, u64 cycles)
+{
+    assert(fs && fs->owner && instance < fs->shm->instances);
+
+    chip8_frame_ring_t *ring = &fs->shm->rings[instance];
+    u32 n = ring->published;
+    chip8_frame_slot_t *slot = &ring->slots[n % CHIP8_FS_SLOTS];
+    u32 seq = slot->seq;
+
+    // seqlock write: odd, contents, even
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    memcpy(slot->vram, vram, sizeof(slot->vram));
+    slot->frame = n;
+    slot->cycles = cycles;
+
+    __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->published, n + 1, __ATOMIC_RELEASE);
+
+    fs_wake(&ring->published);
+}
+
+int chip8_framesrv_poll_input(chip8_framesrv_t *fs, chip8_fs_input_t *ev)
+{
+    while (recv(fs->sock, ev, sizeof(chip8_fs_input_t), 0) == sizeof(chip8_fs_input_t)) {
+        if (ev->instance < fs->shm->instances && ev->key < 16)
+            return 1;
+    }
+
+    return 0;
+}
+
+
+// viewers
+
+int chip8_framesrv_open(chip8_framesrv_t *fs, const char *name)
+{
+    chip8_frame_shm_t *head;
+    int fd;
+
+    assert(fs && name);
+
+    memset(fs, 0, sizeof(chip8_framesrv_t));
+    fs_names(fs, name);
+    fs->sock = -1;
+
+    if ((fd = shm_open(fs->name, O_RDONLY, 0)) < 0)
+        return 0;
+
+    // map the header first to learn the size
+    head = mmap(0, sizeof(chip8_frame_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+
+    if (head == MAP_FAILED || memcmp(head->magic, "C8FS", 4) != 0 ||
+        head->version != FS_VERSION || head->slots != CHIP8_FS_SLOTS) {
+        if (head != MAP_FAILED)
+            munmap(head, sizeof(chip8_frame_shm_t));
+        close(fd);
+        return 0;
+    }
+
+    fs->size = fs_size(head->instances);
+    munmap(head, sizeof(chip8_frame_shm_t));
+
+    fs->shm = mmap(0, fs->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (fs->shm == MAP_FAILED) {
+        fs->shm = 0;
+        return 0;
+    }
+
+    fs->sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+
+    return 1;
+}
+
+const chip8_frame_slot_t *chip8_framesrv_latest(const chip8_framesrv_t *fs, u32 instance, u32 *seq)
+{
+    assert(fs && seq);
+
+    if (instance >= fs->shm->instances)
+        return 0;
+
+    const chip8_frame_ring_t *ring = &fs->shm->rings[instance];
+    u32 n = __atomic_load_n(&ring->published, __ATOMIC_ACQUIRE);
+
+    // the newest slot may already be rewritten, step back to older ones
+    for (u32 back = 1; back <= CHIP8_FS_SLOTS && back <= n; back++) {
+        const chip8_frame_slot_t *slot = &ring->slots[(n - back) % CHIP8_FS_SLOTS];
+        u32 s = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+        if (!(s & 1)) {
+            *seq = s;
+            return slot;
+        }
+    }
+
+    return 0;
+}
+
+int chip8_framesrv_valid(const chip8_frame_slot_t *slot, u32 seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq;
+}
+
+u32 chip8_framesrv_wait(const chip8_framesrv_t *fs, u32 instance, u32 seen, u32 timeout_ms)
+{
+    u32 *word = &fs->shm->rings[instance].published;
+    u32 n = __atomic_load_n(word, __ATOMIC_ACQUIRE);
+
+    if (n != seen)
+        return n;
+
+#ifdef __linux__
+    struct timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000 };
+
+    syscall(SYS_futex, word, FUTEX_WAIT, seen, &ts, 0, 0);
+#else
+    // no cross-process wait to block on, poll at about the frame rate
+    struct timespec ts = { 0, 16000000 };
+
+    if (timeout_ms < 16)
+        ts.tv_nsec = timeout_ms * 1000000;
+    nanosleep(&ts, 0);
+#endif
+
+    return __atomic_load_n(word, __ATOMIC_ACQUIRE);
+}
+
+int chip8_framesrv_send_key(chip8_framesrv_t *fs, u32 instance, u8 key, u8 status)
+{
+    chip8_fs_input_t ev = { instance, key, status };
+    struct sockaddr_un addr;
+
+    fs_addr(fs, &addr);
+
+    return fs->sock >= 0 &&
+           sendto(fs->sock, &ev, sizeof(ev), 0, (struct sockaddr *)&addr, sizeof(addr)) == sizeof(ev);
+}
+
+
+void chip8_framesrv_close(chip8_framesrv_t *fs)
+{
+    assert(fs);
+
+    if (fs->shm)
+        munmap(fs->shm, fs->size);
+
+    if (fs->sock >= 0)
+        close(fs->sock);
+
+    if (fs->owner) {
+        shm_unlink(fs->name);
+        unlink(fs->sock_path);
+    }
+
+    fs->shm = 0;
+    fs->sock = -1;
+}
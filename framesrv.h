@@ -0,0 +1,82 @@
+/*
+ *  framesrv.h
+ *  chip8emu
+ *
+ *  Publishes the frames of one or more instances into shared memory for
+ *  any number of local viewers. Each instance has a ring of slots
+ *  guarded by sequence counters, so viewers read frames in place
+ *  without locking out the emulator. Key events come back over a Unix
+ *  datagram socket.
+ *
+ */
+
+#ifndef FRAMESRV_H
+#define FRAMESRV_H
+
+#include "types.h"
+
+
+// a viewer has this many frames' time to read a slot before it is reused
+#define CHIP8_FS_SLOTS 4
+
+typedef struct {
+    u32 seq;                // odd while the slot is being written
+    u32 reserved;
+    u64 frame;
+    u64 cycles;
+    u8 vram[64*32];
+    u8 pad[40];
+} chip8_frame_slot_t;
+
+typedef struct {
+    u32 published;          // frames published so far, viewers wait on it
+    u8 pad[60];
+    chip8_frame_slot_t slots[CHIP8_FS_SLOTS];
+} chip8_frame_ring_t;
+
+typedef struct {
+    char magic[4];
+    u32 version;
+    u32 instances;
+    u32 slots;
+    u8 pad[48];
+    chip8_frame_ring_t rings[];
+} chip8_frame_shm_t;
+
+typedef struct {
+    chip8_frame_shm_t *shm;
+    u32 size;
+    int owner;
+    int sock;
+    char name[64];
+    char sock_path[108];
+} chip8_framesrv_t;
+
+// input datagrams
+typedef struct {
+    u8 instance;
+    u8 key;
+    u8 status;
+} chip8_fs_input_t;
+
+// server side, the segment is /dev/shm style name and the socket
+// lives next to it in the temp directory
+int chip8_framesrv_create(chip8_framesrv_t *fs, const char *name, u32 instances);
+void chip8_framesrv_publish(chip8_framesrv_t *fs, u32 instance, const u8 *vram, u64 cycles);
+// returns 1 and fills in ev if a key event is pending
+int chip8_framesrv_poll_input(chip8_framesrv_t *fs, chip8_fs_input_t *ev);
+
+// viewer side
+int chip8_framesrv_open(chip8_framesrv_t *fs, const char *name);
+// newest slot of an instance and the sequence to check it against, 0 if none yet
+const chip8_frame_slot_t *chip8_framesrv_latest(const chip8_framesrv_t *fs, u32 instance, u32 *seq);
+// 1 if the slot was not rewritten while it was being read
+int chip8_framesrv_valid(const chip8_frame_slot_t *slot, u32 seq);
+// waits until more than seen frames were published or timeout_ms passed
+u32 chip8_framesrv_wait(const chip8_framesrv_t *fs, u32 instance, u32 seen, u32 timeout_ms);
+int chip8_framesrv_send_key(chip8_framesrv_t *fs, u32 instance, u8 key, u8 status);
+
+void chip8_framesrv_close(chip8_framesrv_t *fs);
+
+
+#endif // FRAMESRV_H
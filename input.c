@@ -0,0 +1,104 @@
+/*
+ *  input.c
+ *  chip8emu
+ *
+ *  Host key events stamped with the emulated cycle they map to, queued
+ *  lock-free and applied by the emulation thread at that cycle.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "input.h"
+
+
+int chip8_input_init(chip8_input_queue_t *q, u32 capacity)
+{
+    assert(q);
+
+    memset(q, 0, sizeof(chip8_input_queue_t));
+
+    return chip8_spsc_init(&q->events, sizeof(chip8_input_t), capacity);
+}
+
+void chip8_input_free(chip8_input_queue_t *q)
+{
+    chip8_spsc_free(&q->events);
+}
+
+// the cycle host_ms falls in on the emulated timeline, never before the
+// anchor
+u64 chip8_input_cycle_at(chip8_input_queue_t *q, u32 host_ms)
+{
+    u64 cycle = __atomic_load_n(&q->anchor_cycle, __ATOMIC_ACQUIRE);
+    u32 ms = __atomic_load_n(&q->anchor_ms, __ATOMIC_ACQUIRE);
+
+    if ((s32)(host_ms - ms) > 0)
+        cycle += (u64)(host_ms - ms) * CHIP8_CYCLES_PER_SECOND / 1000;
+
+    return cycle;
+}
+
+// map the host time onto the emulated timeline and queue the event
+int chip8_input_push(chip8_input_queue_t *q, chip8_keys_t key, u8 status, u32 host_ms)
+{
+    chip8_input_t ev;
+
+    ev.cycle = chip8_input_cycle_at(q, host_ms);
+    ev.host_ms = host_ms;
+    ev.key = key;
+    ev.status = status;
+
+    return chip8_spsc_push(&q->events, &ev);
+}
+
+void chip8_input_anchor(chip8_input_queue_t *q, u64 cycle, u32 host_ms)
+{
+    __atomic_store_n(&q->anchor_ms, host_ms, __ATOMIC_RELEASE);
+    __atomic_store_n(&q->anchor_cycle, cycle, __ATOMIC_RELEASE);
+}
+
+// apply every event due at or before cycle, returns how many were applied
+int chip8_input_apply(chip8_input_queue_t *q, u64 cycle)
+{
+    const chip8_input_t *ev;
+    int applied = 0;
+
+    while ((ev = chip8_spsc_peek(&q->events)) != 0 && ev->cycle <= cycle) {
+        chip8_key_event(ev->key, ev->status);
+
+        if (ev->status)
+            q->pressed_ms = ev->host_ms;
+
+        chip8_spsc_drop(&q->events);
+        applied++;
+    }
+
+    return applied;
+}
+
+// cycle the oldest pending event is due at, ~0 if there is none
+u64 chip8_input_next_cycle(chip8_input_queue_t *q)
+{
+    const chip8_input_t *ev = chip8_spsc_peek(&q->events);
+
+    return ev ? ev->cycle : ~0ULL;
+}
+
+void chip8_input_record_latency(chip8_input_queue_t *q, u32 ms)
+{
+    q->latency_sum += ms;
+    q->latency_count++;
+
+    if (ms > q->latency_max)
+        q->latency_max = ms;
+}
+
+void chip8_input_latency(const chip8_input_queue_t *q, u32 *avg_ms, u32 *max_ms, u32 *count)
+{
+    *avg_ms = q->latency_count ? (u32)(q->latency_sum / q->latency_count) : 0;
+    *max_ms = q->latency_max;
+    *count = q->latency_count;
+}
@@ -0,0 +1,59 @@
+/*
+ *  input.h
+ *  chip8emu
+ *
+ *  Host key events stamped with the emulated cycle they map to, queued
+ *  lock-free and applied by the emulation thread at that cycle.
+ *
+ */
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include "chip8.h"
+#include "spsc.h"
+
+
+typedef struct {
+    u64 cycle;
+    u32 host_ms;
+    u8 key;
+    u8 status;
+} chip8_input_t;
+
+typedef struct {
+    chip8_spsc_t events;
+
+    // emulated cycle at a known host time, set by the emulation thread
+    u64 anchor_cycle;
+    u32 anchor_ms;
+
+    // host time of the last applied press, for latency measurement
+    u32 pressed_ms;
+
+    // key-to-pixel statistics, owned by the presenting thread
+    u64 latency_sum;
+    u32 latency_max;
+    u32 latency_count;
+} chip8_input_queue_t;
+
+int chip8_input_init(chip8_input_queue_t *q, u32 capacity);
+void chip8_input_free(chip8_input_queue_t *q);
+
+// either thread
+u64 chip8_input_cycle_at(chip8_input_queue_t *q, u32 host_ms);
+
+// host thread
+int chip8_input_push(chip8_input_queue_t *q, chip8_keys_t key, u8 status, u32 host_ms);
+
+// emulation thread
+void chip8_input_anchor(chip8_input_queue_t *q, u64 cycle, u32 host_ms);
+int chip8_input_apply(chip8_input_queue_t *q, u64 cycle);
+u64 chip8_input_next_cycle(chip8_input_queue_t *q);
+
+// presenting thread
+void chip8_input_record_latency(chip8_input_queue_t *q, u32 ms);
+void chip8_input_latency(const chip8_input_queue_t *q, u32 *avg_ms, u32 *max_ms, u32 *count);
+
+
+#endif // INPUT_H
@@ -0,0 +1,287 @@
+/*
+ *  lockstep.c
+ *  chip8emu
+ *
+ *  Differential checker for the decode cache and native blocks.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "chip8.h"
+#include "lockstep.h"
+
+
+void chip8_lockstep_init(chip8_lockstep_t *ls, u32 interval)
+{
+    assert(ls && interval);
+
+    memset(ls, 0, sizeof(chip8_lockstep_t));
+    ls->interval = interval;
+
+    chip8_save_state(&ls->fast);
+    chip8_save_state(&ls->ref);
+    ls->ref.decoded = 0;
+    ls->ref.native = 0;
+    ls->ref.breakpoints = 0;
+    ls->fast.breakpoints = 0;
+}
+
+void chip8_lockstep_free(chip8_lockstep_t *ls)
+{
+    chip8_state_t *prev = chip8_current_state();
+    chip8_state_t *states[] = { &ls->ref, &ls->fast, &ls->ref_good, &ls->fast_good };
+
+    assert(ls);
+
+    for (u32 i = 0; i < 4; i++) {
+        chip8_select_state(states[i]);
+        chip8_release_state();
+    }
+
+    chip8_select_state(prev);
+}
+
+void chip8_lockstep_key(chip8_lockstep_t *ls, chip8_keys_t key, u8 status)
+{
+    chip8_state_t *prev = chip8_select_state(&ls->ref);
+
+    chip8_key_event(key, status);
+    chip8_select_state(&ls->fast);
+    chip8_key_event(key, status);
+    chip8_select_state(prev);
+}
+
+
+static int ls_equal_mem(const chip8_state_t *a, const chip8_state_t *b)
+{
+    for (u32 page = 0; page < 16; page++)
+        if (a->page[page] != b->page[page] &&
+            memcmp(a->page[page], b->page[page], CHIP8_PAGE_SIZE) != 0)
+            return 0;
+
+    return 1;
+}
+
+// architectural state only, vram_seq and code_dirty may differ legitimately
+static int ls_equal(const chip8_state_t *a, const chip8_state_t *b)
+{
+    const chip8_cpu_t *x = &a->cpu, *y = &b->cpu;
+
+    return memcmp(x->dreg, y->dreg, sizeof(x->dreg)) == 0 &&
+           x->ireg == y->ireg && x->pc == y->pc && x->sp == y->sp &&
+           x->delay_timer == y->delay_timer && x->sound_timer == y->sound_timer &&
+           memcmp(x->stack, y->stack, sizeof(x->stack)) == 0 &&
+           a->key_wait == b->key_wait && a->rng == b->rng && a->cycles == b->cycles &&
+           ls_equal_mem(a, b) &&
+           memcmp(a->vram, b->vram, sizeof(a->vram)) == 0;
+}
+
+// up to max_blocks blocks or until target cycles, returns blocks run
+static u32 ls_run_fast(chip8_lockstep_t *ls, u64 target, u32 max_blocks)
+{
+    u32 blocks = 0;
+
+    chip8_select_state(&ls->fast);
+
+    while (blocks < max_blocks && ls->fast.cycles < target && chip8_execute_block())
+        blocks++;
+
+    return blocks;
+}
+
+// the reference single steps to wherever the fast side stopped
+static void ls_follow(chip8_lockstep_t *ls)
+{
+    chip8_select_state(&ls->ref);
+
+    while (ls->ref.cycles < ls->fast.cycles && !ls->ref.key_wait)
+        chip8_execute_step();
+}
+
+static void ls_copy(chip8_state_t *dst, const chip8_state_t *src)
+{
+    chip8_select_state(dst);
+    chip8_load_state(src);
+}
+
+// the fast side is what is being checked, so rewinding copies whole
+// states rather than trusting its dirty tracking
+static void ls_rewind(chip8_lockstep_t *ls)
+{
+    ls_copy(&ls->ref, &ls->ref_good);
+    ls_copy(&ls->fast, &ls->fast_good);
+}
+
+static void ls_mark_good(chip8_lockstep_t *ls)
+{
+    ls_copy(&ls->ref_good, &ls->ref);
+    ls_copy(&ls->fast_good, &ls->fast);
+}
+
+// states agree after 0 blocks and disagree after hi, find the block
+// in between that breaks them and leave the good states at its start
+static void ls_bisect(chip8_lockstep_t *ls, u32 hi)
+{
+    u32 lo = 0;
+
+    while (hi - lo > 1) {
+        u32 mid = lo + (hi - lo) / 2;
+
+        ls_rewind(ls);
+        ls_run_fast(ls, ~0ULL, mid);
+        ls_follow(ls);
+
+        if (ls_equal(&ls->ref, &ls->fast))
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    ls_rewind(ls);
+    ls_run_fast(ls, ~0ULL, lo);
+    ls_follow(ls);
+    ls_mark_good(ls);
+
+    ls_run_fast(ls, ~0ULL, 1);
+    ls_follow(ls);
+}
+
+chip8_lockstep_result_t chip8_lockstep_run(chip8_lockstep_t *ls, u64 max_cycles)
+{
+    chip8_state_t *prev = chip8_current_state();
+    chip8_lockstep_result_t result = CHIP8_LOCKSTEP_OK;
+    u64 end = ls->fast.cycles + max_cycles;
+
+    assert(ls);
+
+    ls_mark_good(ls);
+
+    while (ls->fast.cycles < end) {
+        u64 target = ls->fast.cycles + ls->interval;
+        u32 blocks = ls_run_fast(ls, target < end ? target : end, ~0u);
+
+        ls_follow(ls);
+        ls->checks++;
+
+        if (!ls_equal(&ls->ref, &ls->fast)) {
+            ls_bisect(ls, blocks);
+            result = CHIP8_LOCKSTEP_DIVERGED;
+            break;
+        }
+
+        ls_mark_good(ls);
+
+        if (!blocks) {
+            result = CHIP8_LOCKSTEP_KEY_WAIT;
+            break;
+        }
+    }
+
+    chip8_select_state(prev);
+
+    return result;
+}
+
+
+static const char *ls_backend(const chip8_state_t *s)
+{
+    u16 pc = s->cpu.pc;
+    const chip8_native_block_t *block;
+
+    if (pc < CHIP8_PROG_START || pc >= 4096)
+        return "interpreted";
+
+    if (s->native && (block = s->native[pc - CHIP8_PROG_START]) != 0 &&
+        !(s->code_dirty & block->pages))
+        return "native block";
+
+    if (s->decoded && pc < 4095 && !(s->code_dirty & (1 << (pc >> 8))))
+        return "decode cache";
+
+    return "interpreted";
+}
+
+static void ls_diff(const chip8_state_t *a, const chip8_state_t *b, FILE *out)
+{
+    const chip8_cpu_t *x = &a->cpu, *y = &b->cpu;
+    u32 count = 0, pixels = 0;
+
+    for (u32 i = 0; i < 16; i++)
+        if (x->dreg[i] != y->dreg[i])
+            fprintf(out, "  v%x      %02x / %02x\n", i, x->dreg[i], y->dreg[i]);
+
+    if (x->ireg != y->ireg)
+        fprintf(out, "  i       %03x / %03x\n", x->ireg, y->ireg);
+    if (x->pc != y->pc)
+        fprintf(out, "  pc      %03x / %03x\n", x->pc, y->pc);
+    if (x->sp != y->sp)
+        fprintf(out, "  sp      %x / %x\n", x->sp, y->sp);
+    if (x->delay_timer != y->delay_timer)
+        fprintf(out, "  delay   %02x / %02x\n", x->delay_timer, y->delay_timer);
+    if (x->sound_timer != y->sound_timer)
+        fprintf(out, "  sound   %02x / %02x\n", x->sound_timer, y->sound_timer);
+    if (a->key_wait != b->key_wait)
+        fprintf(out, "  keywait %x / %x\n", a->key_wait, b->key_wait);
+    if (a->rng != b->rng)
+        fprintf(out, "  rng     %08x / %08x\n", a->rng, b->rng);
+    if (a->cycles != b->cycles)
+        fprintf(out, "  cycles  %llu / %llu\n", (unsigned long long)a->cycles, (unsigned long long)b->cycles);
+
+    for (u32 i = 0; i < 16; i++)
+        if (x->stack[i] != y->stack[i])
+            fprintf(out, "  stack%-2u %03x / %03x\n", i, x->stack[i], y->stack[i]);
+
+    for (u32 addr = 0; addr < 4096; addr++) {
+        u8 va = chip8_peek(a, addr), vb = chip8_peek(b, addr);
+
+        if (va == vb)
+            continue;
+
+        if (count++ < 8)
+            fprintf(out, "  [%03x]   %02x / %02x\n", addr, va, vb);
+    }
+
+    if (count > 8)
+        fprintf(out, "  ... %u bytes of memory differ\n", count);
+
+    for (u32 p = 0; p < 64*32; p++)
+        pixels += a->vram[p] != b->vram[p];
+
+    if (pixels)
+        fprintf(out, "  %u pixels differ\n", pixels);
+}
+
+void chip8_lockstep_report(const chip8_lockstep_t *ls, FILE *out)
+{
+    static chip8_state_t replay;
+    chip8_state_t *prev;
+
+    assert(ls && out);
+
+    fprintf(out, "diverged in the %s at %03x, cycles %llu to %llu\n",
+            ls_backend(&ls->fast_good), ls->fast_good.cpu.pc,
+            (unsigned long long)ls->fast_good.cycles, (unsigned long long)ls->fast.cycles);
+
+    // replay the reference through the block to show what it executed
+    prev = chip8_select_state(&replay);
+    chip8_load_state(&ls->ref_good);
+
+    while (replay.cycles < ls->ref.cycles && !replay.key_wait) {
+        u16 pc = replay.cpu.pc;
+        u16 opcode = (chip8_peek(&replay, pc) << 8) | chip8_peek(&replay, pc + 1);
+        char text[32];
+
+        chip8_format_instruction(opcode, text, sizeof(text));
+        fprintf(out, "  %03x  %04x  %s\n", pc, opcode, text);
+        chip8_execute_step();
+    }
+
+    chip8_release_state();
+    chip8_select_state(prev);
+
+    fprintf(out, "reference / fast:\n");
+    ls_diff(&ls->ref, &ls->fast, out);
+}
@@ -0,0 +1,46 @@
+/*
+ *  lockstep.h
+ *  chip8emu
+ *
+ *  Differential checker: runs a plain interpreter next to a copy using
+ *  the decode cache or native blocks, compares the two every interval
+ *  cycles and narrows a mismatch down to the first block that went
+ *  wrong.
+ *
+ */
+
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <stdio.h>
+
+#include "chip8.h"
+
+
+typedef enum {
+    CHIP8_LOCKSTEP_OK,          // max_cycles ran without a mismatch
+    CHIP8_LOCKSTEP_DIVERGED,    // see chip8_lockstep_report
+    CHIP8_LOCKSTEP_KEY_WAIT,    // both cpus are parked waiting for a key
+} chip8_lockstep_result_t;
+
+typedef struct {
+    chip8_state_t ref;          // interpreted, no decode cache or blocks
+    chip8_state_t fast;         // whatever backend the source state had
+    chip8_state_t ref_good;     // last point where the two agreed
+    chip8_state_t fast_good;
+    u32 interval;
+    u64 checks;
+} chip8_lockstep_t;
+
+// both sides start from the current state, the fast side keeps its
+// decode cache and native blocks
+void chip8_lockstep_init(chip8_lockstep_t *ls, u32 interval);
+void chip8_lockstep_free(chip8_lockstep_t *ls);
+chip8_lockstep_result_t chip8_lockstep_run(chip8_lockstep_t *ls, u64 max_cycles);
+// between runs only, applied to both sides
+void chip8_lockstep_key(chip8_lockstep_t *ls, chip8_keys_t key, u8 status);
+// after a divergence: the instructions of the failing block and what differs
+void chip8_lockstep_report(const chip8_lockstep_t *ls, FILE *out);
+
+
+#endif // LOCKSTEP_H
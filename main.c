@@ -1,15 +1,54 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "SDL.h"
 
 #include "chip8.h"
+#include "romlib.h"
+#include "tribuf.h"
+#include "beeper.h"
+#include "input.h"
+#include "aot.h"
+#include "tcache.h"
+#include "debug.h"
+#include "recorder.h"
 
 
-void update_screen(SDL_Surface *surface)
+// emulation runs on its own thread and hands finished frames to the
+// main thread, which owns the window and does all presentation
+static chip8_tribuf_t frames;
+static int running = 1;
+
+// sound timer transitions are queued for the audio callback
+#define AUDIO_RATE 44100
+#define AUDIO_SAMPLES 512
+
+static chip8_beeper_t beeper;
+static int audio_open = 0;
+
+// key events are stamped with the cycle they belong to, frames carry
+// the time of the press they respond to when measuring latency
+#define FRAME_SIZE (64*32 + sizeof(u32))
+
+static chip8_input_queue_t input;
+static SDL_sem *input_ready;
+static int parked = 0;
+static int measure_latency = 0;
+static u8 last_vram[64*32];
+
+// picked once at startup so the normal loop carries no debug checks
+static chip8_run_reason_t (*run)(u32 budget, u32 stop, u32 *cycles) = chip8_run;
+static chip8_debugger_t debugger;
+
+// every emulated frame is streamed to disk when recording
+static chip8_recorder_t recorder;
+static int recording = 0;
+
+
+void update_screen(SDL_Surface *surface, const u8 *vram)
 {
     //SDL_LockSurface(surface);
     
-    u8 *vram = chip8_get_vram();
     u32 *pixels = (u32*)surface->pixels;
 
     for (int iy = 0; iy < 32; iy++)
@@ -22,13 +61,282 @@ void update_screen(SDL_Surface *surface)
     SDL_Flip(surface);
 }
 
+void audio_callback(void *data, Uint8 *stream, int len)
+{
+    chip8_beeper_render(&beeper, (s16*)stream, len / 2, SDL_GetTicks());
+}
+
+int open_audio()
+{
+    SDL_AudioSpec spec;
+    const char *samples = getenv("CHIP8_AUDIO_SAMPLES");
+    
+    memset(&spec, 0, sizeof(spec));
+    spec.freq = AUDIO_RATE;
+    spec.format = AUDIO_S16SYS;
+    spec.channels = 1;
+    spec.samples = samples ? atoi(samples) : AUDIO_SAMPLES;
+    spec.callback = audio_callback;
+    
+    if (!chip8_beeper_init(&beeper, AUDIO_RATE, spec.samples))
+        return 0;
+    
+    if (SDL_OpenAudio(&spec, 0) < 0) {
+        chip8_beeper_free(&beeper);
+        return 0;
+    }
+    
+    SDL_PauseAudio(0);
+    
+    return 1;
+}
+
+// block the emulation thread until a key resumes the parked cpu. keys
+// only post input_ready while parked is set, so its count stays bounded
+void wait_for_key()
+{
+    __atomic_store_n(&parked, 1, __ATOMIC_SEQ_CST);
+    
+    // anything pushed before the flag was seen arrived without a post
+    chip8_input_apply(&input, ~0ULL);
+    
+    while (__atomic_load_n(&running, __ATOMIC_ACQUIRE) && chip8_waiting_key()) {
+        SDL_SemWaitTimeout(input_ready, 50);
+        chip8_input_apply(&input, ~0ULL);
+    }
+    
+    __atomic_store_n(&parked, 0, __ATOMIC_SEQ_CST);
+    
+    // posts for events this wait already applied would end the next early
+    while (SDL_SemTryWait(input_ready) == 0)
+        ;
+}
+
+void publish_frame()
+{
+    u8 *frame = chip8_tribuf_back(&frames);
+    u8 *vram = chip8_get_vram();
+    u32 pressed = 0;
+    
+    // stamp the first changed frame after a press with the press time
+    if (measure_latency) {
+        if (input.pressed_ms && memcmp(last_vram, vram, 64*32) != 0) {
+            pressed = input.pressed_ms;
+            input.pressed_ms = 0;
+        }
+        memcpy(last_vram, vram, 64*32);
+    }
+    
+    memcpy(frame, vram, 64*32);
+    memcpy(frame + 64*32, &pressed, sizeof(u32));
+    chip8_tribuf_publish(&frames);
+    
+    if (recording)
+        chip8_recorder_capture(&recorder, vram);
+}
+
+// interprets one instruction at a time, printing each one
+chip8_run_reason_t run_traced(u32 budget, u32 stop, u32 *cycles)
+{
+    u64 start = chip8_get_cycles();
+    int sound = chip8_sound_on();
+    chip8_run_reason_t reason = CHIP8_RUN_BUDGET;
+    
+    while (chip8_get_cycles() - start < budget) {
+        if (chip8_debug_step(&debugger) == CHIP8_DBG_KEY_WAIT) {
+            reason = CHIP8_RUN_KEY_WAIT;
+            break;
+        }
+        
+        if ((stop & CHIP8_STOP_SOUND) && chip8_sound_on() != sound) {
+            reason = CHIP8_RUN_SOUND;
+            break;
+        }
+    }
+    
+    *cycles = chip8_get_cycles() - start;
+    
+    return reason;
+}
+
+// cycles run in step with host time from when emulation actually
+// started, so a key event maps onto a cycle that has not run yet and is
+// applied exactly there. a frame is done about when the next is due
+int emulation_thread(void *data)
+{
+    Uint32 t0 = SDL_GetTicks();
+    u32 frame = 0;
+    
+    chip8_input_anchor(&input, chip8_get_cycles(), t0);
+    
+    while (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        // run a logic frame, breaking it up where input is due or the
+        // beeper has to follow the sound timer
+        for (u32 i = 0; i < CHIP8_CYCLES_PER_FRAME; ) {
+            chip8_input_apply(&input, chip8_get_cycles());
+            
+            if (chip8_waiting_key()) {
+                wait_for_key();
+                
+                if (chip8_waiting_key())
+                    break;
+                
+                // time spent parked is not caught up
+                t0 = SDL_GetTicks();
+                frame = 0;
+                chip8_input_anchor(&input, chip8_get_cycles(), t0);
+            }
+            
+            u64 now = chip8_get_cycles();
+            u64 due = chip8_input_cycle_at(&input, SDL_GetTicks());
+            u32 budget = CHIP8_CYCLES_PER_FRAME - i, cycles;
+            
+            // ahead of the host clock, sleep until the next cycle is due
+            if (due <= now) {
+                SDL_Delay(1);
+                continue;
+            }
+            
+            if (due - now < budget)
+                budget = due - now;
+            
+            if (chip8_input_next_cycle(&input) - now < budget)
+                budget = chip8_input_next_cycle(&input) - now;
+            
+            run(budget, audio_open ? CHIP8_STOP_SOUND : 0, &cycles);
+            i += cycles;
+            
+            if (audio_open)
+                chip8_beeper_update(&beeper, chip8_get_cycles() * AUDIO_RATE / CHIP8_CYCLES_PER_SECOND,
+                                    chip8_sound_on(), SDL_GetTicks());
+        }
+        
+        publish_frame();
+        
+        frame++;
+        
+        Uint32 deadline = t0 + frame * 1000 / CHIP8_FRAMES_PER_SECOND;
+        Uint32 now = SDL_GetTicks();
+        
+        if ((s32)(deadline - now) > 0)
+            SDL_Delay(deadline - now);
+        else if (now - deadline > 100) {
+            // discard pending time
+            t0 = now;
+            frame = 0;
+            chip8_input_anchor(&input, chip8_get_cycles(), t0);
+        }
+    }
+    
+    return 0;
+}
+
+void key_event(chip8_keys_t key, u8 status)
+{
+    chip8_input_push(&input, key, status, SDL_GetTicks());
+    
+    // pairs with wait_for_key: either it sees the event or this sees parked
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    
+    if (__atomic_load_n(&parked, __ATOMIC_SEQ_CST))
+        SDL_SemPost(input_ready);
+}
+
+// returns 0 once the user asked to quit
+int handle_events()
+{
+    SDL_Event event;
+    
+    while (SDL_PollEvent(&event)) {
+        switch (event.type) {
+            case SDL_QUIT:
+                return 0;
+                
+            case SDL_KEYDOWN:
+            case SDL_KEYUP:
+                switch (event.key.keysym.sym) {
+                    case SDLK_ESCAPE: return 0;
+                    case SDLK_KP0: key_event(CHIP8_KEY_0, event.key.state); break;
+                    case SDLK_KP1: key_event(CHIP8_KEY_7, event.key.state); break;
+                    case SDLK_KP2: key_event(CHIP8_KEY_8, event.key.state); break;
+                    case SDLK_KP3: key_event(CHIP8_KEY_9, event.key.state); break;
+                    case SDLK_KP4: key_event(CHIP8_KEY_4, event.key.state); break;
+                    case SDLK_KP5: key_event(CHIP8_KEY_5, event.key.state); break;
+                    case SDLK_KP6: key_event(CHIP8_KEY_6, event.key.state); break;
+                    case SDLK_KP7: key_event(CHIP8_KEY_1, event.key.state); break;
+                    case SDLK_KP8: key_event(CHIP8_KEY_2, event.key.state); break;
+                    case SDLK_KP9: key_event(CHIP8_KEY_3, event.key.state); break;
+
+                    case SDLK_KP_EQUALS: key_event(CHIP8_KEY_A, event.key.state); break;
+                    case SDLK_KP_DIVIDE: key_event(CHIP8_KEY_B, event.key.state); break;
+                    case SDLK_KP_MULTIPLY: key_event(CHIP8_KEY_C, event.key.state); break;
+                    case SDLK_KP_MINUS: key_event(CHIP8_KEY_D, event.key.state); break;
+                    case SDLK_KP_PLUS: key_event(CHIP8_KEY_E, event.key.state); break;
+                    case SDLK_KP_ENTER: key_event(CHIP8_KEY_F, event.key.state); break;
+                    default: break;
+                }
+                break;
+        }
+    }
+    
+    return 1;
+}
+
 int main(int argc, char **argv)
 {
+    const char *rom = argc > 1 ? argv[1] : "chip8roms/syzygy";
+    // the image as loaded, the translation cache is keyed by its contents
+    static u8 data[CHIP8_PROG_SIZE + 1];
+    u32 size = 0;
+    
     chip8_reset_state();
-    chip8_load_rom("/Users/entrox/Coding/repos/chip8emu/chip8roms/syzygy");
+    
+    if (argc > 2) {
+        // load by title from a ROM library archive
+        chip8_romlib_t *lib = chip8_romlib_open(rom);
+        const chip8_romlib_entry_t *entry = lib ? chip8_romlib_find_title(lib, argv[2]) : 0;
+        
+        if (!entry || !chip8_romlib_load(lib, entry)) {
+            printf("Unable to load %s from %s\n", argv[2], rom);
+            chip8_romlib_close(lib);
+            return 1;
+        }
+        
+        size = entry->size;
+        memcpy(data, chip8_romlib_data(lib, entry), size);
+        chip8_romlib_close(lib);
+    } else {
+        FILE *file = fopen(rom, "rb");
+        
+        if (file) {
+            size = fread(data, sizeof(u8), sizeof(data), file);
+            fclose(file);
+        }
+        
+        if (!file || !chip8_load_rom_data(data, size)) {
+            printf("Unable to load %s\n", rom);
+            return 1;
+        }
+    }
+    
+    // decoded program from an earlier run, analysed and stored on a miss
+    char cache_dir[4096];
+    chip8_tcache_t *tc = chip8_tcache_open(chip8_tcache_dir(cache_dir, sizeof(cache_dir)), data, size);
+    
+    chip8_tcache_attach(tc);
+
+    // natively compiled code for this ROM, see tools/chip8aot
+    chip8_aot_t *aot = 0;
+    
+    if (getenv("CHIP8_AOT")) {
+        aot = chip8_aot_load(getenv("CHIP8_AOT"));
+        
+        if (!aot || !chip8_aot_attach(aot))
+            printf("Not using %s, interpreting\n", getenv("CHIP8_AOT"));
+    }
 
     // init SDL
-    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
         printf("Unable to initialize SDL: %s\n", SDL_GetError());
         return 2;
     }
@@ -42,67 +350,87 @@ int main(int argc, char **argv)
         return 4;
     }
     
-    double t0, t1;
-    double frametime, tick_duration;
+    // run silent if there is no audio device
+    if (!(audio_open = open_audio()))
+        printf("Unable to open audio: %s\n", SDL_GetError());
     
-    // 60 hz
-    tick_duration = 1000 / 20;
+    if (!chip8_tribuf_init(&frames, FRAME_SIZE) || !chip8_input_init(&input, 256) ||
+        !(input_ready = SDL_CreateSemaphore(0))) {
+        printf("Unable to allocate frame buffers\n");
+        return 5;
+    }
     
-    t0 = SDL_GetTicks();
+    measure_latency = getenv("CHIP8_MEASURE_LATENCY") != 0;
     
-    while (1) {
-        t1 = SDL_GetTicks();
-        frametime = 0.0;
-        
-        // run a logic frame
-        //while ((t1 - t0) > tick_duration) {
-            chip8_execute_step();
-            update_screen(screen);
+    if (getenv("CHIP8_TRACE")) {
+        chip8_debug_init(&debugger);
+        debugger.trace = 1;
+        run = run_traced;
+    }
+    
+    if (getenv("CHIP8_RECORD")) {
+        if (!(recording = chip8_recorder_open(&recorder, getenv("CHIP8_RECORD"), CHIP8_FRAMES_PER_SECOND)))
+            printf("Unable to record to %s\n", getenv("CHIP8_RECORD"));
+    }
+    
+    SDL_Thread *emulation = SDL_CreateThread(emulation_thread, 0);
+    if (!emulation) {
+        printf("Unable to start emulation thread: %s\n", SDL_GetError());
+        return 6;
+    }
+    
+    // present the newest finished frame until the user quits
+    while (handle_events()) {
+        if (chip8_tribuf_acquire(&frames)) {
+            const u8 *frame = chip8_tribuf_front(&frames);
+            u32 pressed;
             
-            t0 += tick_duration;
-            frametime += tick_duration;
+            update_screen(screen, frame);
             
-            t1 = SDL_GetTicks();
-       // }
+            memcpy(&pressed, frame + 64*32, sizeof(u32));
+            if (pressed)
+                chip8_input_record_latency(&input, SDL_GetTicks() - pressed);
+        } else
+            SDL_Delay(1);
+    }
+    
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    SDL_WaitThread(emulation, 0);
+    
+    chip8_tribuf_free(&frames);
+    
+    if (recording) {
+        u32 dropped = recorder.dropped;
         
-        // event loop
-        SDL_Event event;
-        while (SDL_PollEvent(&event)) {
-            switch (event.type) {
-                case SDL_QUIT:
-                    return 0;
-                    
-                case SDL_KEYDOWN:
-                case SDL_KEYUP:
-                    switch (event.key.keysym.sym) {
-                        case SDLK_ESCAPE: return 0;
-                        case SDLK_KP0: chip8_key_event(CHIP8_KEY_0, event.key.state); break;
-                        case SDLK_KP1: chip8_key_event(CHIP8_KEY_7, event.key.state); break;
-                        case SDLK_KP2: chip8_key_event(CHIP8_KEY_8, event.key.state); break;
-                        case SDLK_KP3: chip8_key_event(CHIP8_KEY_9, event.key.state); break;
-                        case SDLK_KP4: chip8_key_event(CHIP8_KEY_4, event.key.state); break;
-                        case SDLK_KP5: chip8_key_event(CHIP8_KEY_5, event.key.state); break;
-                        case SDLK_KP6: chip8_key_event(CHIP8_KEY_6, event.key.state); break;
-                        case SDLK_KP7: chip8_key_event(CHIP8_KEY_1, event.key.state); break;
-                        case SDLK_KP8: chip8_key_event(CHIP8_KEY_2, event.key.state); break;
-                        case SDLK_KP9: chip8_key_event(CHIP8_KEY_3, event.key.state); break;
-
-                        case SDLK_KP_EQUALS: chip8_key_event(CHIP8_KEY_A, event.key.state); break;
-                        case SDLK_KP_DIVIDE: chip8_key_event(CHIP8_KEY_B, event.key.state); break;
-                        case SDLK_KP_MULTIPLY: chip8_key_event(CHIP8_KEY_C, event.key.state); break;
-                        case SDLK_KP_MINUS: chip8_key_event(CHIP8_KEY_D, event.key.state); break;
-                        case SDLK_KP_PLUS: chip8_key_event(CHIP8_KEY_E, event.key.state); break;
-                        case SDLK_KP_ENTER: chip8_key_event(CHIP8_KEY_F, event.key.state); break;
-                        default: break;
-                    }
-                    break;
-            }
-        }
+        if (!chip8_recorder_close(&recorder))
+            printf("Unable to finish writing %s\n", getenv("CHIP8_RECORD"));
+        else if (dropped)
+            printf("recording dropped %u frames\n", dropped);
+    }
+    
+    if (measure_latency) {
+        u32 avg, max, count;
         
-        // discard pending time
-        if ((t1 - t0) > tick_duration)
-            t0 = t1 - tick_duration;
+        chip8_input_latency(&input, &avg, &max, &count);
+        printf("key to pixel latency: avg %u ms, max %u ms over %u presses\n", avg, max, count);
     }
+    
+    chip8_input_free(&input);
+    
+    chip8_set_native_blocks(0);
+    chip8_aot_unload(aot);
+    chip8_set_decode_cache(0);
+    chip8_tcache_close(tc);
+    SDL_DestroySemaphore(input_ready);
+    
+    if (audio_open) {
+        u32 avg, max;
+        
+        SDL_CloseAudio();
+        chip8_beeper_latency(&beeper, &avg, &max);
+        printf("audio latency: avg %u ms, max %u ms with %u sample buffer\n", avg, max, beeper.buffer);
+        chip8_beeper_free(&beeper);
+    }
+    
+    return 0;
 }
-
-
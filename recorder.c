@@ -0,0 +1,601 @@
+/*
+ *  recorder.c
+ *  chip8emu
+ *
+ *  Streaming framebuffer recorder, playback and GIF/PNG export.
+ *
+ *  file layout, little endian:
+ *    header    "C8RV", u16 version, u8 width, u8 height, u16 fps,
+ *              u16 reserved, u32 frame count
+ *    frames    u8 type, u16 length, length bytes of run-length code
+ *
+ *  key frames code the bit-packed frame itself, delta frames its XOR
+ *  with the previous frame. an unchanged frame is an empty delta.
+ *  codes 0x00-0x7f stand for 1-128 zero bytes, 0x80-0xff are followed
+ *  by 1-128 literal bytes.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+
+#include "chip8.h"
+#include "recorder.h"
+
+
+#define REC_VERSION 1
+#define REC_HEADER_SIZE 16
+#define REC_DELTA 0
+#define REC_KEY 1
+
+// frames the writer may fall behind by before capture drops them
+#define REC_QUEUE 1024
+
+// worst case for a frame that is all literals
+#define REC_MAX_CODE (CHIP8_REC_FRAME_SIZE + CHIP8_REC_FRAME_SIZE / 128 + 1)
+
+
+static void rec_put32(u8 *p, u32 v)
+{
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static void rec_put16(u8 *p, u16 v)
+{
+    p[0] = v; p[1] = v >> 8;
+}
+
+static u32 rec_get32(const u8 *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (u32)p[3] << 24;
+}
+
+static u16 rec_get16(const u8 *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+
+// run-length coding
+
+static u32 rle_encode(const u8 *in, u32 size, u8 *out)
+{
+    u32 len = 0;
+
+    for (u32 i = 0; i < size; ) {
+        u32 n = 0;
+
+        if (in[i] == 0) {
+            while (i + n < size && in[i + n] == 0 && n < 128)
+                n++;
+
+            out[len++] = n - 1;
+        } else {
+            // literals run until a pair of zeros, a lone zero is cheaper inline
+            while (i + n < size && n < 128 &&
+                   (in[i + n] != 0 || (i + n + 1 < size && in[i + n + 1] != 0)))
+                n++;
+
+            out[len++] = 0x80 | (n - 1);
+            memcpy(out + len, in + i, n);
+            len += n;
+        }
+
+        i += n;
+    }
+
+    return len;
+}
+
+// returns 0 unless the code expands to exactly size bytes
+static int rle_decode(const u8 *in, u32 len, u8 *out, u32 size)
+{
+    u32 o = 0;
+
+    for (u32 i = 0; i < len; ) {
+        u32 n = (in[i] & 0x7F) + 1;
+
+        if (o + n > size)
+            return 0;
+
+        if (in[i++] & 0x80) {
+            if (i + n > len)
+                return 0;
+
+            memcpy(out + o, in + i, n);
+            i += n;
+        } else
+            memset(out + o, 0, n);
+
+        o += n;
+    }
+
+    return o == size;
+}
+
+
+// recording
+
+static int rec_header(FILE *file, u32 fps, u32 count)
+{
+    u8 h[REC_HEADER_SIZE];
+
+    memcpy(h, "C8RV", 4);
+    rec_put16(h + 4, REC_VERSION);
+    h[6] = 64;
+    h[7] = 32;
+    rec_put16(h + 8, fps);
+    rec_put16(h + 10, 0);
+    rec_put32(h + 12, count);
+
+    return fseek(file, 0, SEEK_SET) == 0 && fwrite(h, sizeof(h), 1, file) == 1;
+}
+
+static void rec_write_frame(chip8_recorder_t *r, const u8 *frame)
+{
+    u8 delta[CHIP8_REC_FRAME_SIZE];
+    u8 code[3 + REC_MAX_CODE];
+    int key = r->count % CHIP8_REC_KEYFRAME == 0;
+    int changed = 0;
+
+    for (u32 i = 0; i < CHIP8_REC_FRAME_SIZE; i++) {
+        delta[i] = key ? frame[i] : frame[i] ^ r->prev[i];
+        changed |= frame[i] ^ r->prev[i];
+    }
+
+    u32 len = key || changed ? rle_encode(delta, CHIP8_REC_FRAME_SIZE, code + 3) : 0;
+
+    code[0] = key ? REC_KEY : REC_DELTA;
+    rec_put16(code + 1, len);
+
+    if (fwrite(code, 3 + len, 1, r->file) != 1)
+        r->failed = 1;
+
+    memcpy(r->prev, frame, CHIP8_REC_FRAME_SIZE);
+    r->count++;
+    r->bytes += 3 + len;
+}
+
+static void *rec_writer(void *data)
+{
+    chip8_recorder_t *r = data;
+    u8 frame[CHIP8_REC_FRAME_SIZE];
+    struct timespec idle = { 0, 2000000 };
+
+    for (;;) {
+        // read first so nothing pushed before close is missed
+        int running = __atomic_load_n(&r->running, __ATOMIC_ACQUIRE);
+
+        if (chip8_spsc_pop(&r->frames, frame)) {
+            rec_write_frame(r, frame);
+            continue;
+        }
+
+        if (!running)
+            break;
+
+        nanosleep(&idle, 0);
+    }
+
+    return 0;
+}
+
+int chip8_recorder_open(chip8_recorder_t *r, const char *path, u32 fps)
+{
+    assert(r && path);
+
+    memset(r, 0, sizeof(chip8_recorder_t));
+    r->fps = fps;
+
+    if (!chip8_spsc_init(&r->frames, CHIP8_REC_FRAME_SIZE, REC_QUEUE))
+        return 0;
+
+    if ((r->file = fopen(path, "wb")) == 0 || !rec_header(r->file, fps, 0)) {
+        if (r->file)
+            fclose(r->file);
+        chip8_spsc_free(&r->frames);
+        return 0;
+    }
+
+    r->running = 1;
+
+    if (pthread_create(&r->thread, 0, rec_writer, r) != 0) {
+        fclose(r->file);
+        chip8_spsc_free(&r->frames);
+        return 0;
+    }
+
+    return 1;
+}
+
+int chip8_recorder_capture(chip8_recorder_t *r, const u8 *vram)
+{
+    u8 frame[CHIP8_REC_FRAME_SIZE];
+
+    chip8_pack_vram(vram, frame);
+
+    if (!chip8_spsc_push(&r->frames, frame)) {
+        r->dropped++;
+        return 0;
+    }
+
+    return 1;
+}
+
+int chip8_recorder_close(chip8_recorder_t *r)
+{
+    assert(r);
+
+    __atomic_store_n(&r->running, 0, __ATOMIC_RELEASE);
+    pthread_join(r->thread, 0);
+
+    // the frame count is only known now
+    int ok = !r->failed && rec_header(r->file, r->fps, r->count);
+
+    ok = fclose(r->file) == 0 && ok;
+    chip8_spsc_free(&r->frames);
+
+    return ok;
+}
+
+
+// playback
+
+int chip8_playback_open(chip8_playback_t *p, const char *path)
+{
+    u8 h[REC_HEADER_SIZE];
+
+    assert(p && path);
+
+    memset(p, 0, sizeof(chip8_playback_t));
+
+    if ((p->file = fopen(path, "rb")) == 0)
+        return 0;
+
+    if (fread(h, sizeof(h), 1, p->file) != 1 || memcmp(h, "C8RV", 4) != 0 ||
+        rec_get16(h + 4) != REC_VERSION || h[6] != 64 || h[7] != 32) {
+        fclose(p->file);
+        return 0;
+    }
+
+    p->fps = rec_get16(h + 8);
+    p->count = rec_get32(h + 12);
+
+    return 1;
+}
+
+int chip8_playback_next(chip8_playback_t *p)
+{
+    u8 code[REC_MAX_CODE];
+    u8 data[CHIP8_REC_FRAME_SIZE];
+    u8 h[3];
+
+    if (p->index >= p->count || fread(h, sizeof(h), 1, p->file) != 1)
+        return 0;
+
+    u16 len = rec_get16(h + 1);
+
+    if (len > sizeof(code) || (len && fread(code, len, 1, p->file) != 1))
+        return 0;
+
+    if (h[0] == REC_KEY) {
+        if (!rle_decode(code, len, p->frame, CHIP8_REC_FRAME_SIZE))
+            return 0;
+    } else if (len) {
+        if (!rle_decode(code, len, data, CHIP8_REC_FRAME_SIZE))
+            return 0;
+
+        for (u32 i = 0; i < CHIP8_REC_FRAME_SIZE; i++)
+            p->frame[i] ^= data[i];
+    }
+
+    p->index++;
+
+    return 1;
+}
+
+void chip8_playback_close(chip8_playback_t *p)
+{
+    assert(p);
+
+    fclose(p->file);
+    p->file = 0;
+}
+
+
+// gif export
+
+typedef struct {
+    FILE *file;
+    u32 bits;
+    u32 nbits;
+    u8 block[255];
+    u32 len;
+} gif_out_t;
+
+static void gif_flush_block(gif_out_t *g)
+{
+    if (!g->len)
+        return;
+
+    fputc(g->len, g->file);
+    fwrite(g->block, 1, g->len, g->file);
+    g->len = 0;
+}
+
+static void gif_code(gif_out_t *g, u32 code, u32 size)
+{
+    g->bits |= code << g->nbits;
+    g->nbits += size;
+
+    while (g->nbits >= 8) {
+        g->block[g->len++] = g->bits;
+        g->bits >>= 8;
+        g->nbits -= 8;
+
+        if (g->len == sizeof(g->block))
+            gif_flush_block(g);
+    }
+}
+
+static int frame_pixel(const u8 *frame, u32 x, u32 y)
+{
+    return (frame[y * 8 + x / 8] >> (7 - x % 8)) & 1;
+}
+
+// lzw compressed image data for part of a two colour frame
+static void gif_image(gif_out_t *g, const u8 *frame, u32 scale, u32 x0, u32 y0, u32 x1, u32 y1)
+{
+    static u16 next[4096][2];
+    const u32 min_size = 2, clear = 1 << min_size, eoi = clear + 1;
+    u32 size = min_size + 1, max_code = eoi;
+    int prefix = -1;
+
+    memset(next, 0, sizeof(next));
+
+    fputc(min_size, g->file);
+    gif_code(g, clear, size);
+
+    for (u32 y = y0 * scale; y < y1 * scale; y++) {
+        for (u32 x = x0 * scale; x < x1 * scale; x++) {
+            u32 p = frame_pixel(frame, x / scale, y / scale);
+
+            if (prefix < 0) {
+                prefix = p;
+                continue;
+            }
+
+            if (next[prefix][p]) {
+                prefix = next[prefix][p];
+                continue;
+            }
+
+            gif_code(g, prefix, size);
+            next[prefix][p] = ++max_code;
+
+            if (max_code >= (1u << size))
+                size++;
+
+            // dictionary full, start over
+            if (max_code == 4095) {
+                gif_code(g, clear, size);
+                memset(next, 0, sizeof(next));
+                size = min_size + 1;
+                max_code = eoi;
+            }
+
+            prefix = p;
+        }
+    }
+
+    gif_code(g, prefix, size);
+    gif_code(g, eoi, size);
+
+    if (g->nbits)
+        gif_code(g, 0, 8 - g->nbits);
+
+    gif_flush_block(g);
+    fputc(0, g->file);
+}
+
+// only the rectangle that changed since the last frame is stored
+static void gif_frame(gif_out_t *g, const u8 *frame, const u8 *prev, u32 scale, u32 delay_cs)
+{
+    u32 x0 = 64, y0 = 32, x1 = 0, y1 = 0;
+
+    for (u32 y = 0; y < 32; y++)
+        for (u32 x = 0; x < 64; x++)
+            if (!prev || frame_pixel(frame, x, y) != frame_pixel(prev, x, y)) {
+                if (x < x0) x0 = x;
+                if (y < y0) y0 = y;
+                if (x >= x1) x1 = x + 1;
+                if (y >= y1) y1 = y + 1;
+            }
+
+    if (x1 == 0)
+        x0 = y0 = 0, x1 = y1 = 1;
+
+    u32 left = x0 * scale, top = y0 * scale;
+    u32 width = (x1 - x0) * scale, height = (y1 - y0) * scale;
+    u8 h[18] = {
+        // graphic control extension with the frame delay
+        0x21, 0xF9, 0x04, 0x00, delay_cs, delay_cs >> 8, 0x00, 0x00,
+        0x2C, left, left >> 8, top, top >> 8, width, width >> 8, height, height >> 8, 0x00,
+    };
+
+    fwrite(h, sizeof(h), 1, g->file);
+    gif_image(g, frame, scale, x0, y0, x1, y1);
+}
+
+int chip8_export_gif(chip8_playback_t *p, const char *path, u32 scale)
+{
+    gif_out_t g;
+    u8 shown[CHIP8_REC_FRAME_SIZE], last[CHIP8_REC_FRAME_SIZE];
+    u32 fps = p->fps ? p->fps : CHIP8_FRAMES_PER_SECOND;
+    u32 start = 0, frames = 0;
+
+    assert(p && path && scale);
+
+    if (64 * scale > 0xFFFF)
+        return 0;
+
+    memset(&g, 0, sizeof(g));
+
+    if ((g.file = fopen(path, "wb")) == 0)
+        return 0;
+
+    u8 h[] = {
+        'G', 'I', 'F', '8', '9', 'a',
+        64 * scale, (64 * scale) >> 8, 32 * scale, (32 * scale) >> 8,
+        0x80, 0, 0,
+        // black and white global palette
+        0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF,
+        // loop forever
+        0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0',
+        0x03, 0x01, 0x00, 0x00, 0x00,
+    };
+
+    fwrite(h, sizeof(h), 1, g.file);
+
+    // identical frames merge into one longer one, delays are rounded
+    // on the running total so they don't drift
+    while (chip8_playback_next(p)) {
+        if (frames > 0 && memcmp(shown, p->frame, CHIP8_REC_FRAME_SIZE) != 0) {
+            u32 from = start * 100 / fps, to = frames * 100 / fps;
+
+            if (to - from >= 2) {
+                gif_frame(&g, shown, start ? last : 0, scale, to - from);
+                memcpy(last, shown, CHIP8_REC_FRAME_SIZE);
+                start = frames;
+            }
+        }
+
+        // a change too soon after the last one replaces it
+        memcpy(shown, p->frame, CHIP8_REC_FRAME_SIZE);
+
+        frames++;
+    }
+
+    if (frames > start) {
+        u32 delay = frames * 100 / fps - start * 100 / fps;
+
+        gif_frame(&g, shown, start ? last : 0, scale, delay < 2 ? 2 : delay);
+    }
+
+    fputc(0x3B, g.file);
+
+    return fclose(g.file) == 0;
+}
+
+
+// png export, one 1-bit greyscale image per file with stored deflate blocks
+
+static u32 png_crc(u32 crc, const u8 *data, u32 len)
+{
+    static u32 table[256];
+
+    if (!table[1]) {
+        for (u32 n = 0; n < 256; n++) {
+            u32 c = n;
+
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+
+            table[n] = c;
+        }
+    }
+
+    crc = ~crc;
+    for (u32 i = 0; i < len; i++)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+static void png_put32(u8 *p, u32 v)
+{
+    p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static int png_chunk(FILE *file, const char *type, const u8 *data, u32 len)
+{
+    u8 h[8], t[4];
+
+    png_put32(h, len);
+    memcpy(h + 4, type, 4);
+    png_put32(t, png_crc(png_crc(0, h + 4, 4), data, len));
+
+    return fwrite(h, 8, 1, file) == 1 && (!len || fwrite(data, len, 1, file) == 1) &&
+           fwrite(t, 4, 1, file) == 1;
+}
+
+int chip8_export_png(const u8 *frame, const char *path, u32 scale)
+{
+    assert(frame && path && scale);
+
+    u32 width = 64 * scale, height = 32 * scale;
+    u32 stride = 1 + (width + 7) / 8;
+    u32 raw_len = stride * height;
+    u32 blocks = (raw_len + 0xFFFF - 1) / 0xFFFF;
+    u8 *raw = calloc(1, raw_len);
+    u8 *z = malloc(2 + raw_len + 5 * blocks + 4);
+    FILE *file = 0;
+    int ok = 0;
+
+    if (!raw || !z)
+        goto done;
+
+    for (u32 y = 0; y < height; y++)
+        for (u32 x = 0; x < width; x++)
+            if (frame_pixel(frame, x / scale, y / scale))
+                raw[y * stride + 1 + x / 8] |= 0x80 >> (x % 8);
+
+    // zlib stream of stored blocks
+    u32 len = 0, a = 1, b = 0;
+
+    z[len++] = 0x78;
+    z[len++] = 0x01;
+
+    for (u32 i = 0; i < raw_len; i += 0xFFFF) {
+        u32 n = raw_len - i < 0xFFFF ? raw_len - i : 0xFFFF;
+
+        z[len++] = i + n == raw_len;
+        z[len++] = n; z[len++] = n >> 8;
+        z[len++] = ~n; z[len++] = ~n >> 8;
+        memcpy(z + len, raw + i, n);
+        len += n;
+    }
+
+    for (u32 i = 0; i < raw_len; i++) {
+        a = (a + raw[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    png_put32(z + len, b << 16 | a);
+    len += 4;
+
+    u8 ihdr[13];
+
+    png_put32(ihdr, width);
+    png_put32(ihdr + 4, height);
+    ihdr[8] = 1;    // bit depth
+    ihdr[9] = 0;    // greyscale
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+
+    if ((file = fopen(path, "wb")) == 0)
+        goto done;
+
+    ok = fwrite("\x89PNG\r\n\x1a\n", 8, 1, file) == 1 &&
+         png_chunk(file, "IHDR", ihdr, sizeof(ihdr)) &&
+         png_chunk(file, "IDAT", z, len) &&
+         png_chunk(file, "IEND", 0, 0);
+
+    ok = fclose(file) == 0 && ok;
+
+done:
+    free(raw);
+    free(z);
+
+    return ok;
+}
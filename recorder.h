@@ -0,0 +1,69 @@
+/*
+ *  recorder.h
+ *  chip8emu
+ *
+ *  Streaming framebuffer recorder. Frames are bit-packed on the
+ *  emulation thread and handed to a writer thread, which stores them as
+ *  run-length coded XOR deltas against the previous frame. Recordings
+ *  play back frame by frame and export to animated GIF or PNG files.
+ *
+ */
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "types.h"
+#include "spsc.h"
+
+
+#define CHIP8_REC_FRAME_SIZE (64*32 / 8)
+
+// a full frame every this many, so playback can start there
+#define CHIP8_REC_KEYFRAME 600
+
+typedef struct {
+    chip8_spsc_t frames;
+    FILE *file;
+    u32 fps;
+    pthread_t thread;
+    int running;
+    int failed;
+
+    // producer side
+    u32 dropped;
+
+    // writer side
+    u8 prev[CHIP8_REC_FRAME_SIZE];
+    u32 count;
+    u64 bytes;
+} chip8_recorder_t;
+
+int chip8_recorder_open(chip8_recorder_t *r, const char *path, u32 fps);
+// emulation thread, returns 0 if the writer fell behind and the frame was dropped
+int chip8_recorder_capture(chip8_recorder_t *r, const u8 *vram);
+// writes out pending frames, returns 0 if anything failed to write
+int chip8_recorder_close(chip8_recorder_t *r);
+
+
+typedef struct {
+    FILE *file;
+    u32 count;
+    u32 fps;
+    u32 index;
+    u8 frame[CHIP8_REC_FRAME_SIZE];
+} chip8_playback_t;
+
+int chip8_playback_open(chip8_playback_t *p, const char *path);
+// decodes the next frame into p->frame, 0 at the end
+int chip8_playback_next(chip8_playback_t *p);
+void chip8_playback_close(chip8_playback_t *p);
+
+// exporters, frames are bit-packed and scaled up by scale
+int chip8_export_gif(chip8_playback_t *p, const char *path, u32 scale);
+int chip8_export_png(const u8 *frame, const char *path, u32 scale);
+
+
+#endif // RECORDER_H
@@ -0,0 +1,328 @@
+/*
+ *  romlib.c
+ *  chip8emu
+ *
+ *  ROM library: a single memory-mapped archive holding a catalogue of
+ *  ROM images together with an index sorted by content hash.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "chip8.h"
+#include "romlib.h"
+
+
+// images are aligned so every ROM starts on its own cache line
+#define ROMLIB_ALIGN 64
+
+
+// 64 bit FNV-1a over the image contents
+u64 chip8_rom_hash(const u8 *data, u32 size)
+{
+    u64 h = 0xcbf29ce484222325ULL;
+
+    for (u32 i = 0; i < size; i++) {
+        h ^= data[i];
+        h *= 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+// guess the variant from opcodes only SCHIP defines
+static u8 romlib_detect_variant(const u8 *data, u32 size)
+{
+    for (u32 i = 0; i + 1 < size; i += 2) {
+        u16 opcode = (data[i] << 8) | data[i+1];
+
+        switch (opcode) {
+            case 0x00FB:
+            case 0x00FC:
+            case 0x00FE:
+            case 0x00FF:
+                return CHIP8_VARIANT_SCHIP;
+        }
+
+        if ((opcode & 0xF0FF) == 0xF030)
+            return CHIP8_VARIANT_SCHIP;
+    }
+
+    return CHIP8_VARIANT_CHIP8;
+}
+
+
+// building
+
+typedef struct {
+    chip8_romlib_entry_t entry;
+    u8 *data;
+} romlib_item_t;
+
+static int romlib_compare_items(const void *a, const void *b)
+{
+    u64 ha = ((const romlib_item_t *)a)->entry.hash;
+    u64 hb = ((const romlib_item_t *)b)->entry.hash;
+
+    return ha < hb ? -1 : ha > hb;
+}
+
+static int romlib_read_file(const char *path, romlib_item_t *item)
+{
+    FILE *file;
+    u8 buf[CHIP8_PROG_SIZE + 1];
+    size_t size;
+
+    if ((file = fopen(path, "rb")) == 0)
+        return 0;
+
+    size = fread(buf, sizeof(u8), sizeof(buf), file);
+
+    if (ferror(file) || size == 0 || size > CHIP8_PROG_SIZE) {
+        fclose(file);
+        return 0;
+    }
+
+    fclose(file);
+
+    if ((item->data = malloc(size)) == 0)
+        return 0;
+
+    memcpy(item->data, buf, size);
+
+    item->entry.hash = chip8_rom_hash(buf, size);
+    item->entry.size = size;
+    item->entry.variant = romlib_detect_variant(buf, size);
+
+    return 1;
+}
+
+int chip8_romlib_build(const char *dir, const char *archive)
+{
+    DIR *d;
+    struct dirent *de;
+    romlib_item_t *items = 0;
+    u32 count = 0, capacity = 0, written = 0;
+    u32 offset;
+    FILE *file = 0;
+    int ok = 0;
+
+    assert(dir && archive);
+
+    if ((d = opendir(dir)) == 0)
+        return 0;
+
+    while ((de = readdir(d)) != 0) {
+        char path[4096];
+        struct stat st;
+
+        if (de->d_name[0] == '.')
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+
+        if (stat(path, &st) < 0 || !S_ISREG(st.st_mode))
+            continue;
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            romlib_item_t *grown = realloc(items, capacity * sizeof(romlib_item_t));
+            if (!grown)
+                goto out;
+            items = grown;
+        }
+
+        memset(&items[count], 0, sizeof(romlib_item_t));
+
+        // skip anything that is not a loadable image
+        if (!romlib_read_file(path, &items[count]))
+            continue;
+
+        // long file names are cut to the title field
+        snprintf(items[count].entry.title, sizeof(items[count].entry.title), "%.*s",
+                 (int)sizeof(items[count].entry.title) - 1, de->d_name);
+        count++;
+    }
+
+    qsort(items, count, sizeof(romlib_item_t), romlib_compare_items);
+
+    // drop duplicate images, keeping the first title
+    for (u32 i = 0; i < count; i++) {
+        if (written > 0 && items[written-1].entry.hash == items[i].entry.hash) {
+            free(items[i].data);
+            continue;
+        }
+        items[written++] = items[i];
+    }
+    count = written;
+
+    // lay out the images behind the index
+    offset = sizeof(chip8_romlib_header_t) + count * sizeof(chip8_romlib_entry_t);
+    for (u32 i = 0; i < count; i++) {
+        offset = (offset + ROMLIB_ALIGN - 1) & ~(ROMLIB_ALIGN - 1);
+        items[i].entry.offset = offset;
+        offset += items[i].entry.size;
+    }
+
+    if ((file = fopen(archive, "wb")) == 0)
+        goto out;
+
+    chip8_romlib_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHIP8_ROMLIB_MAGIC, 4);
+    header.version = CHIP8_ROMLIB_VERSION;
+    header.count = count;
+
+    if (fwrite(&header, sizeof(header), 1, file) != 1)
+        goto out;
+
+    for (u32 i = 0; i < count; i++)
+        if (fwrite(&items[i].entry, sizeof(chip8_romlib_entry_t), 1, file) != 1)
+            goto out;
+
+    for (u32 i = 0; i < count; i++) {
+        if (fseek(file, items[i].entry.offset, SEEK_SET) < 0)
+            goto out;
+        if (fwrite(items[i].data, sizeof(u8), items[i].entry.size, file) != items[i].entry.size)
+            goto out;
+    }
+
+    ok = 1;
+
+out:
+    if (file && fclose(file) != 0)
+        ok = 0;
+
+    for (u32 i = 0; i < count; i++)
+        free(items[i].data);
+    free(items);
+    closedir(d);
+
+    return ok;
+}
+
+
+// lookup
+
+chip8_romlib_t *chip8_romlib_open(const char *archive)
+{
+    int fd;
+    struct stat st;
+    void *base;
+    chip8_romlib_t *lib;
+    const chip8_romlib_header_t *header;
+    const chip8_romlib_entry_t *entries;
+
+    assert(archive);
+
+    if ((fd = open(archive, O_RDONLY)) < 0)
+        return 0;
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(chip8_romlib_header_t)) {
+        close(fd);
+        return 0;
+    }
+
+    base = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (base == MAP_FAILED)
+        return 0;
+
+    header = base;
+
+    if (memcmp(header->magic, CHIP8_ROMLIB_MAGIC, 4) != 0 ||
+        header->version != CHIP8_ROMLIB_VERSION ||
+        sizeof(chip8_romlib_header_t) + (size_t)header->count * sizeof(chip8_romlib_entry_t) > (size_t)st.st_size) {
+        munmap(base, st.st_size);
+        return 0;
+    }
+
+    entries = (const chip8_romlib_entry_t *)(header + 1);
+
+    // callers index tables with the variant, reject ones this build lacks
+    for (u32 i = 0; i < header->count; i++) {
+        if (entries[i].variant > CHIP8_VARIANT_SCHIP) {
+            munmap(base, st.st_size);
+            return 0;
+        }
+    }
+
+    if ((lib = malloc(sizeof(chip8_romlib_t))) == 0) {
+        munmap(base, st.st_size);
+        return 0;
+    }
+
+    lib->base = base;
+    lib->length = st.st_size;
+    lib->count = header->count;
+    lib->entries = entries;
+
+    return lib;
+}
+
+void chip8_romlib_close(chip8_romlib_t *lib)
+{
+    if (!lib)
+        return;
+
+    munmap((void *)lib->base, lib->length);
+    free(lib);
+}
+
+const chip8_romlib_entry_t *chip8_romlib_find(const chip8_romlib_t *lib, u64 hash)
+{
+    u32 lo = 0, hi = lib->count;
+
+    // binary search over the sorted index
+    while (lo < hi) {
+        u32 mid = lo + (hi - lo) / 2;
+
+        if (lib->entries[mid].hash < hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < lib->count && lib->entries[lo].hash == hash)
+        return &lib->entries[lo];
+
+    return 0;
+}
+
+const chip8_romlib_entry_t *chip8_romlib_find_title(const chip8_romlib_t *lib, const char *title)
+{
+    for (u32 i = 0; i < lib->count; i++)
+        if (strncmp(lib->entries[i].title, title, sizeof(lib->entries[i].title)) == 0)
+            return &lib->entries[i];
+
+    return 0;
+}
+
+const u8 *chip8_romlib_data(const chip8_romlib_t *lib, const chip8_romlib_entry_t *entry)
+{
+    assert(lib && entry);
+
+    if ((size_t)entry->offset + entry->size > lib->length)
+        return 0;
+
+    return lib->base + entry->offset;
+}
+
+int chip8_romlib_load(const chip8_romlib_t *lib, const chip8_romlib_entry_t *entry)
+{
+    const u8 *data = chip8_romlib_data(lib, entry);
+
+    if (!data)
+        return 0;
+
+    return chip8_load_rom_data(data, entry->size);
+}
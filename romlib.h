@@ -0,0 +1,65 @@
+/*
+ *  romlib.h
+ *  chip8emu
+ *
+ *  ROM library: a single memory-mapped archive holding a catalogue of
+ *  ROM images together with an index sorted by content hash.
+ *
+ */
+
+#ifndef ROMLIB_H
+#define ROMLIB_H
+
+#include <stddef.h>
+
+#include "types.h"
+
+
+#define CHIP8_ROMLIB_MAGIC "C8RL"
+#define CHIP8_ROMLIB_VERSION 2
+
+// variants
+
+typedef enum {
+    CHIP8_VARIANT_CHIP8,
+    CHIP8_VARIANT_SCHIP,
+} chip8_variant_t;
+
+// on-disk layout: header, entries sorted by hash, then the ROM images
+
+typedef struct {
+    char magic[4];
+    u32 version;
+    u32 count;
+    u32 reserved;
+} chip8_romlib_header_t;
+
+typedef struct {
+    u64 hash;
+    u32 offset;
+    u16 size;
+    u8 variant;
+    char title[32];
+} chip8_romlib_entry_t;
+
+
+typedef struct {
+    const u8 *base;
+    size_t length;
+    u32 count;
+    const chip8_romlib_entry_t *entries;
+} chip8_romlib_t;
+
+u64 chip8_rom_hash(const u8 *data, u32 size);
+
+int chip8_romlib_build(const char *dir, const char *archive);
+chip8_romlib_t *chip8_romlib_open(const char *archive);
+void chip8_romlib_close(chip8_romlib_t *lib);
+
+const chip8_romlib_entry_t *chip8_romlib_find(const chip8_romlib_t *lib, u64 hash);
+const chip8_romlib_entry_t *chip8_romlib_find_title(const chip8_romlib_t *lib, const char *title);
+const u8 *chip8_romlib_data(const chip8_romlib_t *lib, const chip8_romlib_entry_t *entry);
+int chip8_romlib_load(const chip8_romlib_t *lib, const chip8_romlib_entry_t *entry);
+
+
+#endif // ROMLIB_H
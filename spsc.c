@@ -0,0 +1,80 @@
+/*
+ *  spsc.c
+ *  chip8emu
+ *
+ *  Lock-free single producer, single consumer ring of fixed size items.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "spsc.h"
+
+
+// capacity must be a power of two
+int chip8_spsc_init(chip8_spsc_t *q, u32 item_size, u32 capacity)
+{
+    assert(q && capacity && !(capacity & (capacity - 1)));
+
+    memset(q, 0, sizeof(chip8_spsc_t));
+
+    if ((q->buf = malloc((size_t)item_size * capacity)) == 0)
+        return 0;
+
+    q->item_size = item_size;
+    q->mask = capacity - 1;
+
+    return 1;
+}
+
+void chip8_spsc_free(chip8_spsc_t *q)
+{
+    free(q->buf);
+    q->buf = 0;
+}
+
+// returns 0 if the ring is full
+int chip8_spsc_push(chip8_spsc_t *q, const void *item)
+{
+    u32 head = q->head;
+    u32 tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail > q->mask)
+        return 0;
+
+    memcpy(q->buf + (size_t)(head & q->mask) * q->item_size, item, q->item_size);
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+// oldest item or 0 if empty, valid until dropped
+const void *chip8_spsc_peek(chip8_spsc_t *q)
+{
+    u32 tail = q->tail;
+
+    if (__atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == tail)
+        return 0;
+
+    return q->buf + (size_t)(tail & q->mask) * q->item_size;
+}
+
+void chip8_spsc_drop(chip8_spsc_t *q)
+{
+    __atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+}
+
+int chip8_spsc_pop(chip8_spsc_t *q, void *item)
+{
+    const void *p = chip8_spsc_peek(q);
+
+    if (!p)
+        return 0;
+
+    memcpy(item, p, q->item_size);
+    chip8_spsc_drop(q);
+
+    return 1;
+}
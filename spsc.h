@@ -0,0 +1,38 @@
+/*
+ *  spsc.h
+ *  chip8emu
+ *
+ *  Lock-free single producer, single consumer ring of fixed size items.
+ *
+ */
+
+#ifndef SPSC_H
+#define SPSC_H
+
+#include "types.h"
+
+
+typedef struct {
+    u8 *buf;
+    u32 item_size;
+    u32 mask;
+    // producer and consumer indices live on separate cache lines
+    u32 head;
+    u8 pad0[60];
+    u32 tail;
+    u8 pad1[60];
+} chip8_spsc_t;
+
+int chip8_spsc_init(chip8_spsc_t *q, u32 item_size, u32 capacity);
+void chip8_spsc_free(chip8_spsc_t *q);
+
+// producer
+int chip8_spsc_push(chip8_spsc_t *q, const void *item);
+
+// consumer
+const void *chip8_spsc_peek(chip8_spsc_t *q);
+void chip8_spsc_drop(chip8_spsc_t *q);
+int chip8_spsc_pop(chip8_spsc_t *q, void *item);
+
+
+#endif // SPSC_H
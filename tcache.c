@@ -0,0 +1,281 @@
+/*
+ *  tcache.c
+ *  chip8emu
+ *
+ *  Persistent translation cache: per-ROM decode and control flow analysis,
+ *  stored on disk keyed by content hash and emulator version and mapped
+ *  back in on the next load.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "chip8.h"
+#include "romlib.h"
+#include "tcache.h"
+
+
+// analysis
+
+static void tcache_mark(chip8_tcache_data_t *out, u16 *work, int *nwork, u16 addr, u8 flags)
+{
+    if (addr < CHIP8_PROG_START || addr >= 4095)
+        return;
+
+    out->flags[addr - CHIP8_PROG_START] |= flags;
+
+    if (!(out->flags[addr - CHIP8_PROG_START] & CHIP8_TC_CODE))
+        work[(*nwork)++] = addr;
+}
+
+// follow control flow from root, mem is the program area plus one
+// padding byte. addresses already marked as code are not revisited
+void chip8_tcache_walk(chip8_tcache_data_t *out, const u8 *mem, u16 root, u8 flags)
+{
+    u16 work[2 * CHIP8_PROG_SIZE + 1];
+    int nwork = 0;
+
+    tcache_mark(out, work, &nwork, root, CHIP8_TC_LEADER | flags);
+
+    while (nwork > 0) {
+        u16 pc = work[--nwork];
+        int i = pc - CHIP8_PROG_START;
+
+        // pushes are deduplicated lazily
+        if (out->flags[i] & CHIP8_TC_CODE)
+            continue;
+
+        out->flags[i] |= CHIP8_TC_CODE;
+
+        u16 opcode = (mem[i] << 8) | mem[i+1];
+        u16 target = opcode & 0xFFF;
+
+        switch (out->icode[i]) {
+            case I_JMP:
+                tcache_mark(out, work, &nwork, target, CHIP8_TC_LEADER | CHIP8_TC_JUMP);
+                break;
+
+            case I_JSR:
+                tcache_mark(out, work, &nwork, target, CHIP8_TC_LEADER | CHIP8_TC_SUBROUTINE);
+                tcache_mark(out, work, &nwork, pc + 2, CHIP8_TC_LEADER);
+                break;
+
+            case I_SKEQI:
+            case I_SKNEI:
+            case I_SKEQ:
+            case I_SKNE:
+            case I_SKPR:
+            case I_SKUP:
+                tcache_mark(out, work, &nwork, pc + 2, CHIP8_TC_LEADER);
+                tcache_mark(out, work, &nwork, pc + 4, CHIP8_TC_LEADER | CHIP8_TC_JUMP);
+                break;
+
+            // no statically known successor
+            case I_RTS:
+            case I_JMI:
+            case I_UNKNOWN:
+                break;
+
+            default:
+                tcache_mark(out, work, &nwork, pc + 2, 0);
+                break;
+        }
+    }
+}
+
+void chip8_tcache_analyze(const u8 *rom, u32 size, chip8_tcache_data_t *out)
+{
+    u8 mem[CHIP8_PROG_SIZE + 1];
+
+    assert(rom && size <= CHIP8_PROG_SIZE);
+
+    memset(mem, 0, sizeof(mem));
+    memcpy(mem, rom, size);
+
+    memset(out, 0, sizeof(chip8_tcache_data_t));
+    memcpy(out->header.magic, CHIP8_TCACHE_MAGIC, 4);
+    out->header.emu_version = CHIP8_EMU_VERSION;
+    out->header.rom_hash = chip8_rom_hash(rom, size);
+    out->header.rom_size = size;
+
+    // decode every byte address, jumps may land on odd ones
+    for (int i = 0; i < CHIP8_PROG_SIZE; i++)
+        out->icode[i] = chip8_decode_instruction((mem[i] << 8) | mem[i+1]);
+
+    // walk the reachable code from the entry point
+    chip8_tcache_walk(out, mem, CHIP8_PROG_START, 0);
+
+    for (int i = 0; i < CHIP8_PROG_SIZE; i++)
+        if ((out->flags[i] & (CHIP8_TC_CODE | CHIP8_TC_LEADER)) == (CHIP8_TC_CODE | CHIP8_TC_LEADER))
+            out->header.block_count++;
+}
+
+
+// cache files
+
+static int tcache_valid(const chip8_tcache_data_t *data, u64 hash, u32 size)
+{
+    return memcmp(data->header.magic, CHIP8_TCACHE_MAGIC, 4) == 0 &&
+           data->header.emu_version == CHIP8_EMU_VERSION &&
+           data->header.rom_hash == hash &&
+           data->header.rom_size == size;
+}
+
+static chip8_tcache_t *tcache_map(const char *path, u64 hash, u32 size)
+{
+    int fd;
+    struct stat st;
+    void *base;
+    chip8_tcache_t *tc;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return 0;
+
+    if (fstat(fd, &st) < 0 || st.st_size != sizeof(chip8_tcache_data_t)) {
+        close(fd);
+        return 0;
+    }
+
+    base = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (base == MAP_FAILED)
+        return 0;
+
+    if (!tcache_valid(base, hash, size) || (tc = malloc(sizeof(chip8_tcache_t))) == 0) {
+        munmap(base, st.st_size);
+        return 0;
+    }
+
+    tc->data = base;
+    tc->length = st.st_size;
+    tc->mapped = 1;
+
+    return tc;
+}
+
+static void tcache_write(const char *path, const chip8_tcache_data_t *data)
+{
+    char tmp[4096];
+    FILE *file;
+    int n;
+
+    // write to a temporary and rename so readers never see partial files,
+    // a truncated name could rename some other file over the cache
+    n = snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+
+    if (n < 0 || (size_t)n >= sizeof(tmp))
+        return;
+
+    if ((file = fopen(tmp, "wb")) == 0)
+        return;
+
+    if (fwrite(data, sizeof(chip8_tcache_data_t), 1, file) != 1) {
+        fclose(file);
+        unlink(tmp);
+        return;
+    }
+
+    if (fclose(file) != 0 || rename(tmp, path) != 0)
+        unlink(tmp);
+}
+
+const char *chip8_tcache_dir(char *buf, u32 size)
+{
+    const char *dir = getenv("CHIP8_TCACHE");
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    int n;
+
+    assert(buf);
+
+    if (dir)
+        return *dir ? dir : 0;
+
+    if (xdg && *xdg)
+        n = snprintf(buf, size, "%s/chip8emu", xdg);
+    else if (home && *home) {
+        // ~/.cache itself may not exist yet
+        n = snprintf(buf, size, "%s/.cache", home);
+
+        if (n < 0 || (u32)n >= size || (mkdir(buf, 0755) != 0 && errno != EEXIST))
+            return 0;
+
+        n = snprintf(buf, size, "%s/.cache/chip8emu", home);
+    } else
+        return 0;
+
+    if (n < 0 || (u32)n >= size || (mkdir(buf, 0755) != 0 && errno != EEXIST))
+        return 0;
+
+    return buf;
+}
+
+chip8_tcache_t *chip8_tcache_open(const char *dir, const u8 *rom, u32 size)
+{
+    char path[4096];
+    chip8_tcache_t *tc;
+    chip8_tcache_data_t *data;
+    u64 hash;
+
+    assert(rom);
+
+    if (size > CHIP8_PROG_SIZE)
+        return 0;
+
+    hash = chip8_rom_hash(rom, size);
+
+    if (dir) {
+        snprintf(path, sizeof(path), "%s/%016llx.c8tc", dir, hash);
+
+        if ((tc = tcache_map(path, hash, size)) != 0)
+            return tc;
+    }
+
+    // cold: analyse and persist for the next run
+    if ((tc = malloc(sizeof(chip8_tcache_t))) == 0)
+        return 0;
+
+    if ((data = malloc(sizeof(chip8_tcache_data_t))) == 0) {
+        free(tc);
+        return 0;
+    }
+
+    chip8_tcache_analyze(rom, size, data);
+
+    if (dir)
+        tcache_write(path, data);
+
+    tc->data = data;
+    tc->length = sizeof(chip8_tcache_data_t);
+    tc->mapped = 0;
+
+    return tc;
+}
+
+void chip8_tcache_close(chip8_tcache_t *tc)
+{
+    if (!tc)
+        return;
+
+    if (tc->mapped)
+        munmap((void *)tc->data, tc->length);
+    else
+        free((void *)tc->data);
+
+    free(tc);
+}
+
+// the cache must outlive the attachment and match the loaded ROM
+void chip8_tcache_attach(const chip8_tcache_t *tc)
+{
+    chip8_set_decode_cache(tc ? tc->data->icode : 0);
+}
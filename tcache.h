@@ -0,0 +1,64 @@
+/*
+ *  tcache.h
+ *  chip8emu
+ *
+ *  Persistent translation cache: per-ROM decode and control flow analysis,
+ *  stored on disk keyed by content hash and emulator version and mapped
+ *  back in on the next load.
+ *
+ */
+
+#ifndef TCACHE_H
+#define TCACHE_H
+
+#include <stddef.h>
+
+#include "chip8.h"
+
+
+#define CHIP8_TCACHE_MAGIC "C8TC"
+
+// per address flags
+#define CHIP8_TC_CODE       0x01    // reachable instruction starts here
+#define CHIP8_TC_LEADER     0x02    // first instruction of a basic block
+#define CHIP8_TC_SUBROUTINE 0x04    // target of a jsr
+#define CHIP8_TC_JUMP       0x08    // target of a jmp or skip
+#define CHIP8_TC_TABLE      0x10    // entry of a jmi jump table
+
+
+typedef struct {
+    char magic[4];
+    u32 emu_version;
+    u64 rom_hash;
+    u32 rom_size;
+    u32 block_count;
+} chip8_tcache_header_t;
+
+// analysis of the program area, indexed by address - CHIP8_PROG_START
+typedef struct {
+    chip8_tcache_header_t header;
+    u8 icode[CHIP8_PROG_SIZE];
+    u8 flags[CHIP8_PROG_SIZE];
+} chip8_tcache_data_t;
+
+
+typedef struct {
+    const chip8_tcache_data_t *data;
+    size_t length;
+    int mapped;
+} chip8_tcache_t;
+
+void chip8_tcache_analyze(const u8 *rom, u32 size, chip8_tcache_data_t *out);
+void chip8_tcache_walk(chip8_tcache_data_t *out, const u8 *mem, u16 root, u8 flags);
+
+// $CHIP8_TCACHE, else chip8emu under the user's cache directory, created
+// if missing. 0 when there is none or CHIP8_TCACHE is empty, which keeps
+// the analysis in memory
+const char *chip8_tcache_dir(char *buf, u32 size);
+// a 0 dir or a miss analyses the ROM, misses are written back to dir
+chip8_tcache_t *chip8_tcache_open(const char *dir, const u8 *rom, u32 size);
+void chip8_tcache_close(chip8_tcache_t *tc);
+void chip8_tcache_attach(const chip8_tcache_t *tc);
+
+
+#endif // TCACHE_H
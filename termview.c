@@ -0,0 +1,131 @@
+/*
+ *  termview.c
+ *  chip8emu
+ *
+ *  Renders vram as Unicode half blocks or braille with diff-only output.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include "termview.h"
+
+
+void chip8_termview_init(chip8_termview_t *v, chip8_term_mode_t mode)
+{
+    assert(v);
+
+    memset(v, 0, sizeof(chip8_termview_t));
+    v->mode = mode;
+    v->cols = mode == CHIP8_TERM_BRAILLE ? 32 : 64;
+    v->rows = mode == CHIP8_TERM_BRAILLE ? 8 : 16;
+}
+
+void chip8_termview_invalidate(chip8_termview_t *v)
+{
+    v->valid = 0;
+}
+
+// pixels of a cell as bits, braille dot numbering for braille cells
+static u8 term_cell(const chip8_termview_t *v, const u8 *vram, u32 col, u32 row)
+{
+    if (v->mode == CHIP8_TERM_HALF)
+        return vram[row * 2 * 64 + col] | vram[(row * 2 + 1) * 64 + col] << 1;
+
+    const u8 *p = &vram[row * 4 * 64 + col * 2];
+
+    return p[0] | p[64] << 1 | p[128] << 2 | p[1] << 3 |
+           p[65] << 4 | p[129] << 5 | p[192] << 6 | p[193] << 7;
+}
+
+static u32 term_glyph(const chip8_termview_t *v, u8 cell, char *out)
+{
+    static const char *half[] = { " ", "\xE2\x96\x80", "\xE2\x96\x84", "\xE2\x96\x88" };
+
+    if (v->mode == CHIP8_TERM_HALF) {
+        u32 n = strlen(half[cell]);
+
+        memcpy(out, half[cell], n);
+        return n;
+    }
+
+    // U+2800 plus the dot bits
+    out[0] = 0xE2;
+    out[1] = 0xA0 | (cell >> 6);
+    out[2] = 0x80 | (cell & 0x3F);
+
+    return 3;
+}
+
+u32 chip8_termview_render(chip8_termview_t *v, const u8 *vram, char *buf)
+{
+    u32 len = 0;
+    u32 at_col = ~0u, at_row = ~0u;
+
+    assert(v && vram && buf);
+
+    // a cleared terminal shows blank cells, diff against that
+    if (!v->valid) {
+        len += sprintf(buf + len, "\x1b[?25l\x1b[2J");
+        memset(v->cells, 0, sizeof(v->cells));
+        v->valid = 1;
+    }
+
+    for (u32 row = 0; row < v->rows; row++) {
+        for (u32 col = 0; col < v->cols; col++) {
+            u8 cell = term_cell(v, vram, col, row);
+            u8 *old = &v->cells[row * v->cols + col];
+
+            if (*old == cell)
+                continue;
+
+            // writing a cell moves the cursor along, short gaps are
+            // cheaper to repeat than to jump over
+            if (row == at_row && col > at_col && col - at_col <= 2) {
+                for (u32 c = at_col; c < col; c++)
+                    len += term_glyph(v, v->cells[row * v->cols + c], buf + len);
+            } else if (row != at_row || col != at_col)
+                len += sprintf(buf + len, "\x1b[%u;%uH", row + 1, col + 1);
+
+            len += term_glyph(v, cell, buf + len);
+            *old = cell;
+            at_row = row;
+            at_col = col + 1;
+        }
+    }
+
+    return len;
+}
+
+
+// keyboard
+
+int chip8_term_keys(const char *input, u32 n, u8 *keys)
+{
+    static const char layout[] = "x123qweasdzc4rfv";
+    int count = 0;
+
+    assert(input && keys);
+
+    if (n == 1 && input[0] == 0x1b)
+        return -1;
+
+    for (u32 i = 0; i < n; i++) {
+        // the rest of an escape sequence, like the A of an arrow's \x1b[A,
+        // would fold into a keypad letter, so nothing after it counts
+        if (input[i] == 0x1b)
+            break;
+
+        // fold case for letters only, | 0x20 would turn ctrl-q..t into 1..4
+        char c = isupper((unsigned char)input[i]) ? input[i] | 0x20 : input[i];
+        const char *p = c ? strchr(layout, c) : 0;
+
+        if (p)
+            keys[count++] = p - layout;
+    }
+
+    return count;
+}
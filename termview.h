@@ -0,0 +1,48 @@
+/*
+ *  termview.h
+ *  chip8emu
+ *
+ *  Renders vram as Unicode half blocks or braille into a buffer of
+ *  terminal output, emitting only the cells that changed since the
+ *  last frame that was rendered.
+ *
+ */
+
+#ifndef TERMVIEW_H
+#define TERMVIEW_H
+
+#include "types.h"
+
+
+typedef enum {
+    CHIP8_TERM_HALF,        // 64x16 cells of two pixels stacked
+    CHIP8_TERM_BRAILLE,     // 32x8 cells of 2x4 pixels
+} chip8_term_mode_t;
+
+// enough for a full redraw in either mode
+#define CHIP8_TERM_MAX_OUTPUT 16384
+
+typedef struct {
+    chip8_term_mode_t mode;
+    u32 cols;
+    u32 rows;
+    u8 cells[64*16];
+    u8 valid;
+} chip8_termview_t;
+
+void chip8_termview_init(chip8_termview_t *v, chip8_term_mode_t mode);
+// forget what the terminal shows, the next frame redraws every cell
+void chip8_termview_invalidate(chip8_termview_t *v);
+// buf must hold CHIP8_TERM_MAX_OUTPUT bytes, returns the length used
+u32 chip8_termview_render(chip8_termview_t *v, const u8 *vram, char *buf);
+
+// terminals only report presses, keys are held this long after each one
+#define CHIP8_TERM_KEY_HOLD_FRAMES 6
+
+// keypad keys typed in one read of raw input, 1234 qwer asdf zxcv. keys
+// must hold n entries, returns how many were stored or -1 if the read was
+// a lone escape
+int chip8_term_keys(const char *input, u32 n, u8 *keys);
+
+
+#endif // TERMVIEW_H
@@ -0,0 +1,67 @@
+/*
+ *  beepdump.c
+ *  chip8emu
+ *
+ *  Runs a ROM headless and writes the beeper output to a WAV file.
+ *
+ *  usage: beepdump <rom> <out.wav> [frames]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "chip8.h"
+#include "beeper.h"
+
+
+#define RATE 44100
+#define SAMPLES_PER_FRAME (RATE / CHIP8_FRAMES_PER_SECOND)
+
+int main(int argc, char **argv)
+{
+    chip8_beeper_t beeper;
+    chip8_wav_t wav;
+    s16 samples[SAMPLES_PER_FRAME];
+    int frames;
+    
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <rom> <out.wav> [frames]\n", argv[0]);
+        return 2;
+    }
+    
+    frames = argc > 3 ? atoi(argv[3]) : 60 * CHIP8_FRAMES_PER_SECOND;
+    
+    chip8_reset_state();
+    
+    if (!chip8_load_rom(argv[1])) {
+        fprintf(stderr, "Unable to load %s\n", argv[1]);
+        return 1;
+    }
+    
+    if (!chip8_beeper_init(&beeper, RATE, 0) || !chip8_wav_open(&wav, argv[2], RATE)) {
+        fprintf(stderr, "Unable to open %s\n", argv[2]);
+        return 1;
+    }
+    
+    // emulate a frame, then synthesize exactly that frame's samples
+    for (int f = 0; f < frames; f++) {
+        for (u32 i = 0, cycles; i < CHIP8_CYCLES_PER_FRAME; i += cycles) {
+            if (chip8_run(CHIP8_CYCLES_PER_FRAME - i, CHIP8_STOP_SOUND, &cycles) == CHIP8_RUN_KEY_WAIT)
+                break;
+            
+            chip8_beeper_update(&beeper, chip8_get_cycles() * RATE / CHIP8_CYCLES_PER_SECOND, chip8_sound_on(), 0);
+        }
+        
+        chip8_beeper_render(&beeper, samples, SAMPLES_PER_FRAME, 0);
+        
+        if (!chip8_wav_write(&wav, samples, SAMPLES_PER_FRAME)) {
+            fprintf(stderr, "Unable to write %s\n", argv[2]);
+            return 1;
+        }
+    }
+    
+    chip8_beeper_free(&beeper);
+    
+    return chip8_wav_close(&wav) ? 0 : 1;
+}
@@ -0,0 +1,283 @@
+/*
+ *  chip8aot.c
+ *  chip8emu
+ *
+ *  Ahead-of-time compiler: walks a ROM's control flow from 0x200, emits
+ *  C for every reachable block and compiles it into a shared object the
+ *  emulator loads with chip8_aot_load.
+ *
+ *  usage: chip8aot [-I include dir] [-c] <rom> <output>
+ *
+ *  With -c only the C source is written. The generated code calls back
+ *  into the chip8_instr_* functions of the host executable for anything
+ *  it does not inline, so the host must export them (-rdynamic).
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "romlib.h"
+#include "tcache.h"
+
+
+// longest straight-line run emitted into one block
+#define MAX_BLOCK 64
+
+// how a block ends
+typedef enum {
+    END_NONE,       // keep going
+    END_CONTROL,    // pc already set by the instruction
+    END_CALL,       // called instruction may park the cpu or modify code
+} block_end_t;
+
+static const char *instr_names[] = {
+    "scdown", "cls", "rts", "scright", "scleft", "low", "high", "jmp",
+    "jsr", "skeqi", "sknei", "skeq", "movi", "addi", "mov", "or", "and",
+    "xor", "add", "sub", "shr", "rsb", "shl", "skne", "mvi", "jmi", "rand",
+    "sprite", "xsprite", "skpr", "skup", "gdelay", "key", "sdelay",
+    "ssound", "adi", "font", "xfont", "bcd", "str", "ldr", "unknown"
+};
+
+static u8 mem[CHIP8_PROG_SIZE + 1];
+static chip8_tcache_data_t analysis;
+static u8 wanted[CHIP8_PROG_SIZE];
+
+
+static void emit_skip(FILE *out, u16 pc, const char *cond)
+{
+    fprintf(out, "    s->cpu.pc = (%s) ? 0x%03x : 0x%03x;\n", cond, pc + 4, pc + 2);
+}
+
+// emits one instruction, returns how the block continues
+static block_end_t emit_instruction(FILE *out, u16 pc, u16 opcode, int icode)
+{
+    int x = (opcode & 0x0F00) >> 8;
+    int y = (opcode & 0x00F0) >> 4;
+    int nn = opcode & 0xFF;
+    int nnn = opcode & 0xFFF;
+    char cond[64];
+
+    fprintf(out, "    TICK();\n");
+
+    switch (icode) {
+        case I_MOVI: fprintf(out, "    V(%d) = %d;\n", x, nn); break;
+        case I_ADDI: fprintf(out, "    V(%d) += %d;\n", x, nn); break;
+        case I_MOV: fprintf(out, "    V(%d) = V(%d);\n", x, y); break;
+        case I_OR: fprintf(out, "    V(%d) |= V(%d);\n", x, y); break;
+        case I_AND: fprintf(out, "    V(%d) &= V(%d);\n", x, y); break;
+        case I_XOR: fprintf(out, "    V(%d) ^= V(%d);\n", x, y); break;
+
+        // statement order mirrors the interpreter so vf as operand behaves the same
+        case I_ADD: fprintf(out, "    V(15) = V(%d) + V(%d) > 255;\n    V(%d) = V(%d) + V(%d);\n", x, y, x, x, y); break;
+        case I_SUB: fprintf(out, "    V(15) = V(%d) > V(%d);\n    V(%d) = V(%d) - V(%d);\n", x, y, x, x, y); break;
+        case I_SHR: fprintf(out, "    V(15) = V(%d) & 0x1;\n    V(%d) >>= 1;\n", x, x); break;
+        case I_RSB: fprintf(out, "    V(15) = V(%d) > V(%d);\n    V(%d) = V(%d) - V(%d);\n", y, x, x, y, x); break;
+        case I_SHL: fprintf(out, "    V(15) = V(%d) >> 7;\n    V(%d) <<= 1;\n", x, x); break;
+
+        case I_MVI: fprintf(out, "    s->cpu.ireg = 0x%03x;\n", nnn); break;
+        case I_ADI: fprintf(out, "    s->cpu.ireg += V(%d);\n", x); break;
+        case I_FONT: fprintf(out, "    s->cpu.ireg = 0x%03x + (V(%d) & 0xF) * 5;\n", CHIP8_FONT_ADDR, x); break;
+        case I_GDELAY: fprintf(out, "    V(%d) = s->cpu.delay_timer;\n", x); break;
+        case I_SDELAY: fprintf(out, "    s->cpu.delay_timer = V(%d);\n", x); break;
+        case I_SSOUND: fprintf(out, "    s->cpu.sound_timer = V(%d);\n", x); break;
+
+        case I_JMP:
+            fprintf(out, "    s->cpu.pc = 0x%03x;\n", nnn);
+            return END_CONTROL;
+
+        case I_JSR:
+            fprintf(out, "    s->cpu.stack[s->cpu.sp++] = 0x%03x;\n    s->cpu.pc = 0x%03x;\n", pc + 2, nnn);
+            return END_CONTROL;
+
+        case I_RTS:
+            fprintf(out, "    s->cpu.pc = s->cpu.stack[--s->cpu.sp];\n    s->cpu.stack[s->cpu.sp] = 0;\n");
+            return END_CONTROL;
+
+        case I_JMI:
+            fprintf(out, "    s->cpu.pc = V(0) + 0x%03x;\n", nnn);
+            return END_CONTROL;
+
+        case I_SKEQI: snprintf(cond, sizeof(cond), "V(%d) == %d", x, nn); emit_skip(out, pc, cond); return END_CONTROL;
+        case I_SKNEI: snprintf(cond, sizeof(cond), "V(%d) != %d", x, nn); emit_skip(out, pc, cond); return END_CONTROL;
+        case I_SKEQ: snprintf(cond, sizeof(cond), "V(%d) == V(%d)", x, y); emit_skip(out, pc, cond); return END_CONTROL;
+        case I_SKNE: snprintf(cond, sizeof(cond), "V(%d) != V(%d)", x, y); emit_skip(out, pc, cond); return END_CONTROL;
+        case I_SKPR: snprintf(cond, sizeof(cond), "s->cpu.kreg[V(%d)]", x); emit_skip(out, pc, cond); return END_CONTROL;
+        case I_SKUP: snprintf(cond, sizeof(cond), "!s->cpu.kreg[V(%d)]", x); emit_skip(out, pc, cond); return END_CONTROL;
+
+        // everything else goes through the interpreter's implementation
+        default:
+            fprintf(out, "    s->cpu.pc = 0x%03x;\n    chip8_instr_%s(0x%04x);\n", pc, instr_names[icode], opcode);
+
+            // stores may hit code, key parks, unknown is most likely data
+            if (icode == I_BCD || icode == I_STR || icode == I_KEY || icode == I_UNKNOWN)
+                return END_CALL;
+            break;
+    }
+
+    return END_NONE;
+}
+
+static u32 emit_block(FILE *out, u16 start, u16 *pages)
+{
+    u16 pc = start;
+    u32 n = 0;
+    block_end_t end = END_NONE;
+
+    fprintf(out, "static u32 blk_%03x(chip8_state_t *s)\n{\n", start);
+
+    *pages = 0;
+
+    while (end == END_NONE && n < MAX_BLOCK && pc < 4095) {
+        int i = pc - CHIP8_PROG_START;
+        u16 opcode = (mem[i] << 8) | mem[i+1];
+
+        *pages |= (1 << (pc >> 8)) | (1 << ((pc + 1) >> 8));
+
+        fprintf(out, "    // %03x: %04x %s\n", pc, opcode, instr_names[analysis.icode[i]]);
+        end = emit_instruction(out, pc, opcode, analysis.icode[i]);
+
+        pc += 2;
+        n++;
+    }
+
+    // straight-line code continues in another block
+    if (end == END_NONE)
+        fprintf(out, "    s->cpu.pc = 0x%03x;\n", pc);
+
+    if (end != END_CONTROL && pc < 4095)
+        wanted[pc - CHIP8_PROG_START] = 1;
+
+    fprintf(out, "    return %u;\n}\n\n", n);
+
+    return n;
+}
+
+static int generate(FILE *out, u32 size)
+{
+    u16 pages[CHIP8_PROG_SIZE];
+    u8 done[CHIP8_PROG_SIZE];
+    int count = 0, progress = 1;
+
+    memset(done, 0, sizeof(done));
+
+    for (int i = 0; i < CHIP8_PROG_SIZE; i++)
+        wanted[i] = (analysis.flags[i] & (CHIP8_TC_CODE | CHIP8_TC_LEADER)) == (CHIP8_TC_CODE | CHIP8_TC_LEADER);
+
+    fprintf(out, "// generated by chip8aot, do not edit\n\n");
+    fprintf(out, "#include \"chip8.h\"\n\n");
+    fprintf(out, "#define V(r) s->cpu.dreg[r]\n");
+    fprintf(out, "#define TICK() do { \\\n"
+                 "    if (s->cpu.delay_timer > 0) s->cpu.delay_timer--; \\\n"
+                 "    if (s->cpu.sound_timer > 0) s->cpu.sound_timer--; \\\n"
+                 "    s->cycles++; \\\n"
+                 "} while (0)\n\n");
+
+    for (int i = 0; i < I_UNKNOWN + 1; i++)
+        fprintf(out, "extern void chip8_instr_%s(u16 opcode);\n", instr_names[i]);
+    fprintf(out, "\n");
+
+    // blocks ending in a call want their continuation compiled as well
+    while (progress) {
+        progress = 0;
+        for (int i = 0; i < CHIP8_PROG_SIZE - 1; i++) {
+            if (wanted[i] && !done[i]) {
+                done[i] = 1;
+                emit_block(out, i + CHIP8_PROG_START, &pages[i]);
+                count++;
+                progress = 1;
+            }
+        }
+    }
+
+    fprintf(out, "const u32 chip8_aot_version = %d;\n", CHIP8_EMU_VERSION);
+    fprintf(out, "const u64 chip8_aot_rom_hash = 0x%016llxULL;\n", chip8_rom_hash(mem, size));
+    fprintf(out, "const u32 chip8_aot_rom_size = %u;\n", size);
+    fprintf(out, "const u32 chip8_aot_block_count = %d;\n\n", count);
+
+    fprintf(out, "const chip8_native_block_t chip8_aot_blocks[] = {\n");
+    for (int i = 0; i < CHIP8_PROG_SIZE; i++)
+        if (done[i])
+            fprintf(out, "    {0x%03x, 0x%04x, blk_%03x},\n", i + CHIP8_PROG_START, pages[i], i + CHIP8_PROG_START);
+    fprintf(out, "    {0, 0, 0}\n};\n");
+
+    return count;
+}
+
+int main(int argc, char **argv)
+{
+    const char *include = ".";
+    int source_only = 0;
+    int arg = 1;
+
+    while (arg < argc && argv[arg][0] == '-') {
+        if (strcmp(argv[arg], "-I") == 0 && arg + 1 < argc) {
+            include = argv[arg + 1];
+            arg += 2;
+        } else if (strcmp(argv[arg], "-c") == 0) {
+            source_only = 1;
+            arg++;
+        } else
+            break;
+    }
+
+    if (argc - arg != 2) {
+        fprintf(stderr, "usage: %s [-I include dir] [-c] <rom> <output>\n", argv[0]);
+        return 2;
+    }
+
+    FILE *file = fopen(argv[arg], "rb");
+    if (!file) {
+        fprintf(stderr, "Unable to open %s\n", argv[arg]);
+        return 1;
+    }
+
+    u32 size = fread(mem, sizeof(u8), CHIP8_PROG_SIZE + 1, file);
+    fclose(file);
+
+    if (size > CHIP8_PROG_SIZE) {
+        fprintf(stderr, "%s does not fit into memory\n", argv[arg]);
+        return 1;
+    }
+
+    chip8_tcache_analyze(mem, size, &analysis);
+
+    char source[4096];
+    snprintf(source, sizeof(source), source_only ? "%s" : "%s.c", argv[arg + 1]);
+
+    FILE *out = fopen(source, "w");
+    if (!out) {
+        fprintf(stderr, "Unable to write %s\n", source);
+        return 1;
+    }
+
+    int count = generate(out, size);
+
+    if (fclose(out) != 0) {
+        fprintf(stderr, "Unable to write %s\n", source);
+        return 1;
+    }
+
+    fprintf(stderr, "%d blocks\n", count);
+
+    if (source_only)
+        return 0;
+
+    const char *cc = getenv("CC") ? getenv("CC") : "cc";
+    char command[16384];
+
+#ifdef __APPLE__
+    const char *flags = "-O2 -shared -fPIC -undefined dynamic_lookup";
+#else
+    const char *flags = "-O2 -shared -fPIC";
+#endif
+
+    snprintf(command, sizeof(command), "%s %s -I'%s' -o '%s' '%s'", cc, flags, include, argv[arg + 1], source);
+
+    int status = system(command);
+    remove(source);
+
+    return status == 0 ? 0 : 1;
+}
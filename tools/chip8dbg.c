@@ -0,0 +1,182 @@
+/*
+ *  chip8dbg.c
+ *  chip8emu
+ *
+ *  Headless command line debugger.
+ *
+ *  usage: chip8dbg <rom>
+ *
+ *  commands, addresses and values in hex:
+ *    b <addr>              toggle a breakpoint
+ *    r <first> [last]      watch memory reads
+ *    w <first> [last]      watch memory writes
+ *    i                     toggle the index register watch
+ *    cond v<x> <op> <val>  stop when vx becomes ==, !=, < or > val
+ *    uncond                remove all conditions
+ *    s [count]             step instructions
+ *    c [cycles]            continue, by default for a minute of emulation
+ *    k <key>               press and release a key for a parked cpu
+ *    regs                  show registers
+ *    dis [addr] [count]    disassemble memory
+ *    trace                 toggle printing every executed instruction
+ *    q                     quit
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "debug.h"
+
+
+static const char *stop_names[] = {
+    "budget exhausted",
+    "step",
+    "breakpoint",
+    "read watchpoint",
+    "write watchpoint",
+    "index register changed",
+    "condition",
+    "waiting for a key",
+};
+
+static void show_regs()
+{
+    const chip8_state_t *s = chip8_current_state();
+
+    printf("pc=%03x i=%03x sp=%x dt=%02x st=%02x cycles=%llu\n",
+           s->cpu.pc, s->cpu.ireg, s->cpu.sp, s->cpu.delay_timer, s->cpu.sound_timer,
+           (unsigned long long)s->cycles);
+
+    for (int r = 0; r < 16; r++)
+        printf("v%x=%02x%s", r, s->cpu.dreg[r], r == 7 || r == 15 ? "\n" : " ");
+}
+
+static void disassemble(u16 addr, u32 count)
+{
+    const chip8_state_t *s = chip8_current_state();
+    char text[32];
+
+    for (u32 n = 0; n < count && addr < 4095; n++, addr += 2) {
+        u16 opcode = (chip8_peek(s, addr) << 8) | chip8_peek(s, addr + 1);
+
+        chip8_format_instruction(opcode, text, sizeof(text));
+        printf("%c %03x  %04x  %s\n", addr == s->cpu.pc ? '>' : ' ', addr, opcode, text);
+    }
+}
+
+static void report(chip8_debugger_t *dbg, chip8_debug_stop_t stop)
+{
+    switch (stop) {
+        case CHIP8_DBG_WATCH_READ:
+        case CHIP8_DBG_WATCH_WRITE:
+            printf("%s at %03x by %03x\n", stop_names[stop], dbg->stop_addr, dbg->stop_pc);
+            break;
+
+        case CHIP8_DBG_WATCH_IREG:
+            printf("%s to %03x by %03x\n", stop_names[stop], dbg->stop_addr, dbg->stop_pc);
+            break;
+
+        case CHIP8_DBG_CONDITION:
+            printf("%s on v%x by %03x\n", stop_names[stop], dbg->stop_addr, dbg->stop_pc);
+            break;
+
+        default:
+            printf("%s\n", stop_names[stop]);
+            break;
+    }
+
+    disassemble(chip8_current_state()->cpu.pc, 1);
+}
+
+static int parse_op(const char *text, chip8_debug_op_t *op)
+{
+    if (strcmp(text, "==") == 0) *op = CHIP8_COND_EQ;
+    else if (strcmp(text, "!=") == 0) *op = CHIP8_COND_NE;
+    else if (strcmp(text, "<") == 0) *op = CHIP8_COND_LT;
+    else if (strcmp(text, ">") == 0) *op = CHIP8_COND_GT;
+    else return 0;
+
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    chip8_debugger_t dbg;
+    char line[256];
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <rom>\n", argv[0]);
+        return 2;
+    }
+
+    chip8_reset_state();
+
+    if (!chip8_load_rom(argv[1])) {
+        fprintf(stderr, "Unable to load %s\n", argv[1]);
+        return 1;
+    }
+
+    chip8_debug_init(&dbg);
+    disassemble(chip8_current_state()->cpu.pc, 1);
+
+    while (printf("(chip8) "), fflush(stdout), fgets(line, sizeof(line), stdin)) {
+        char cmd[16] = "", a1[16] = "", a2[16] = "", a3[16] = "";
+        int n = sscanf(line, "%15s %15s %15s %15s", cmd, a1, a2, a3);
+        u32 x = strtoul(a1, 0, 16);
+        u32 y = n > 2 ? strtoul(a2, 0, 16) : x;
+
+        if (n < 1)
+            continue;
+
+        if (strcmp(cmd, "q") == 0)
+            break;
+        else if (strcmp(cmd, "b") == 0 && n > 1) {
+            int on = !(dbg.breakpoints[(x & 0xFFF) >> 3] & (1 << (x & 7)));
+
+            chip8_debug_break(&dbg, x, on);
+            printf("breakpoint at %03x %s\n", x & 0xFFF, on ? "set" : "cleared");
+        } else if ((strcmp(cmd, "r") == 0 || strcmp(cmd, "w") == 0) && n > 1) {
+            int read = cmd[0] == 'r';
+
+            for (u32 a = x; a <= y && a < 4096; a++)
+                chip8_debug_watch(&dbg, a, a,
+                                  read || (dbg.watch_read[a >> 3] & (1 << (a & 7))),
+                                  !read || (dbg.watch_write[a >> 3] & (1 << (a & 7))));
+        } else if (strcmp(cmd, "i") == 0) {
+            dbg.watch_ireg = !dbg.watch_ireg;
+            printf("index register watch %s\n", dbg.watch_ireg ? "on" : "off");
+        } else if (strcmp(cmd, "cond") == 0 && n > 3 && a1[0] == 'v') {
+            chip8_debug_op_t op;
+
+            if (!parse_op(a2, &op) || !chip8_debug_condition(&dbg, strtoul(a1 + 1, 0, 16), op, strtoul(a3, 0, 16)))
+                printf("Invalid condition\n");
+        } else if (strcmp(cmd, "uncond") == 0)
+            chip8_debug_clear_conditions(&dbg);
+        else if (strcmp(cmd, "s") == 0) {
+            chip8_debug_stop_t stop = CHIP8_DBG_STEP;
+
+            for (u32 i = 0; i < (n > 1 ? x : 1) && stop == CHIP8_DBG_STEP; i++)
+                stop = chip8_debug_step(&dbg);
+
+            report(&dbg, stop);
+        } else if (strcmp(cmd, "c") == 0)
+            report(&dbg, chip8_debug_continue(&dbg, n > 1 ? x : 60 * CHIP8_CYCLES_PER_SECOND));
+        else if (strcmp(cmd, "k") == 0 && n > 1) {
+            chip8_key_event(x & 0xF, 1);
+            chip8_key_event(x & 0xF, 0);
+        } else if (strcmp(cmd, "regs") == 0)
+            show_regs();
+        else if (strcmp(cmd, "dis") == 0)
+            disassemble(n > 1 ? x : chip8_current_state()->cpu.pc, n > 2 ? strtoul(a2, 0, 16) : 8);
+        else if (strcmp(cmd, "trace") == 0) {
+            dbg.trace = !dbg.trace;
+            printf("trace %s\n", dbg.trace ? "on" : "off");
+        } else
+            printf("Unknown command %s\n", cmd);
+    }
+
+    return 0;
+}
@@ -0,0 +1,239 @@
+/*
+ *  chip8diff.c
+ *  chip8emu
+ *
+ *  Checks the decode cache or an ahead-of-time compiled ROM against
+ *  the plain interpreter.
+ *
+ *  usage: chip8diff [-a lib] [-c dir] [-n interval] [-m cycles] [-k seed] [-l log] <rom>
+ *
+ *  -a checks the native blocks in lib (see tools/chip8aot), otherwise
+ *  the decode cache is checked, read from or written to dir with -c.
+ *  -n sets how many cycles run between comparisons, -m how many run in
+ *  total. -k presses pseudo-random keys so input paths get exercised.
+ *
+ *  -l replays an input log to reproduce a reported run. each line holds
+ *  "cycle key status" with the key in hex, e.g. "1200 a 1", in cycle
+ *  order; blank lines and lines starting with # are skipped. an event is
+ *  applied at the first block boundary at or past its cycle, or as soon
+ *  as both cpus wait for a key.
+ *
+ *  exits with 1 and prints the failing block on a divergence.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "aot.h"
+#include "tcache.h"
+#include "lockstep.h"
+
+
+// cycles between key changes with -k
+#define KEY_PERIOD (CHIP8_CYCLES_PER_FRAME * 6)
+
+
+typedef struct {
+    u64 cycle;
+    u8 key;
+    u8 status;
+} key_event_t;
+
+// the whole log is read up front so a bad line fails before any cycle runs
+static key_event_t *load_log(const char *path, u32 *count)
+{
+    key_event_t *events = 0, *grown;
+    u32 capacity = 0, line = 0;
+    char text[128];
+    FILE *file;
+
+    *count = 0;
+
+    if (!(file = fopen(path, "r"))) {
+        fprintf(stderr, "Unable to open %s\n", path);
+        return 0;
+    }
+
+    while (fgets(text, sizeof(text), file)) {
+        unsigned long long cycle;
+        unsigned key, status;
+        char *p = text + strspn(text, " \t");
+
+        line++;
+
+        if (*p == '#' || *p == '\n' || *p == '\0')
+            continue;
+
+        if (sscanf(p, "%llu %x %u", &cycle, &key, &status) != 3 || key > 0xF || status > 1 ||
+            (*count && cycle < events[*count - 1].cycle)) {
+            fprintf(stderr, "%s:%u: expected \"cycle key status\" in cycle order\n", path, line);
+            break;
+        }
+
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+
+            if (!(grown = realloc(events, capacity * sizeof(key_event_t))))
+                break;
+
+            events = grown;
+        }
+
+        events[*count].cycle = cycle;
+        events[*count].key = key;
+        events[(*count)++].status = status;
+    }
+
+    if (!feof(file)) {
+        free(events);
+        events = 0;
+    }
+
+    fclose(file);
+
+    return events;
+}
+
+int main(int argc, char **argv)
+{
+    static u8 rom[CHIP8_PROG_SIZE + 1];
+    static chip8_lockstep_t ls;
+    const char *aot_path = 0, *cache_dir = 0, *log_path = 0;
+    key_event_t *events = 0;
+    u32 interval = 1000, seed = 0, event_count = 0;
+    u64 max_cycles = 10000000;
+    int arg = 1;
+
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-a") == 0 && arg + 1 < argc)
+            aot_path = argv[++arg];
+        else if (strcmp(argv[arg], "-c") == 0 && arg + 1 < argc)
+            cache_dir = argv[++arg];
+        else if (strcmp(argv[arg], "-n") == 0 && arg + 1 < argc)
+            interval = atoi(argv[++arg]);
+        else if (strcmp(argv[arg], "-m") == 0 && arg + 1 < argc)
+            max_cycles = strtoull(argv[++arg], 0, 0);
+        else if (strcmp(argv[arg], "-k") == 0 && arg + 1 < argc)
+            seed = strtoul(argv[++arg], 0, 0) | 1;
+        else if (strcmp(argv[arg], "-l") == 0 && arg + 1 < argc)
+            log_path = argv[++arg];
+        else
+            break;
+    }
+
+    if (arg >= argc || !interval) {
+        fprintf(stderr, "usage: %s [-a lib] [-c dir] [-n interval] [-m cycles] [-k seed] [-l log] <rom>\n", argv[0]);
+        return 2;
+    }
+
+    if (log_path && !(events = load_log(log_path, &event_count)))
+        return 2;
+
+    FILE *file = fopen(argv[arg], "rb");
+    if (!file) {
+        fprintf(stderr, "Unable to open %s\n", argv[arg]);
+        return 2;
+    }
+
+    u32 size = fread(rom, sizeof(u8), sizeof(rom), file);
+    fclose(file);
+
+    chip8_reset_state();
+
+    if (!chip8_load_rom_data(rom, size)) {
+        fprintf(stderr, "Unable to load %s\n", argv[arg]);
+        return 2;
+    }
+
+    chip8_aot_t *aot = 0;
+    chip8_tcache_t *tc = 0;
+
+    if (aot_path) {
+        if (!(aot = chip8_aot_load(aot_path)) || !chip8_aot_attach(aot)) {
+            fprintf(stderr, "%s does not match %s\n", aot_path, argv[arg]);
+            return 2;
+        }
+    } else {
+        if (!(tc = chip8_tcache_open(cache_dir, rom, size))) {
+            fprintf(stderr, "Unable to analyse %s\n", argv[arg]);
+            return 2;
+        }
+
+        chip8_tcache_attach(tc);
+    }
+
+    chip8_lockstep_init(&ls, interval);
+
+    chip8_lockstep_result_t result = CHIP8_LOCKSTEP_OK;
+    u64 done = 0, next_random = seed ? KEY_PERIOD : ~0ULL;
+    u32 next_event = 0;
+    int key = -1;
+
+    while (done < max_cycles) {
+        u64 stop = max_cycles;
+
+        if (next_random < stop)
+            stop = next_random;
+        if (next_event < event_count && events[next_event].cycle < stop)
+            stop = events[next_event].cycle;
+
+        if (stop > done) {
+            result = chip8_lockstep_run(&ls, stop - done);
+            done = ls.fast.cycles;
+
+            if (result == CHIP8_LOCKSTEP_DIVERGED)
+                break;
+        }
+
+        // logged events that are due, a parked cpu takes the next one early
+        if (next_event < event_count &&
+            (events[next_event].cycle <= done || result == CHIP8_LOCKSTEP_KEY_WAIT)) {
+            chip8_lockstep_key(&ls, events[next_event].key, events[next_event].status);
+            next_event++;
+            result = CHIP8_LOCKSTEP_OK;
+            continue;
+        }
+
+        if (!seed) {
+            if (result == CHIP8_LOCKSTEP_KEY_WAIT)
+                break;
+            continue;
+        }
+
+        if (done < next_random && result != CHIP8_LOCKSTEP_KEY_WAIT)
+            continue;
+
+        // xorshift, about half the time no key is held
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+
+        if (key >= 0)
+            chip8_lockstep_key(&ls, key, 0);
+
+        key = (seed & 0x10) ? (int)(seed & 0xF) : -1;
+
+        if (key >= 0)
+            chip8_lockstep_key(&ls, key, 1);
+
+        next_random = done + KEY_PERIOD;
+        result = CHIP8_LOCKSTEP_OK;
+    }
+
+    if (result == CHIP8_LOCKSTEP_DIVERGED)
+        chip8_lockstep_report(&ls, stdout);
+    else
+        printf("%s: %llu cycles, %llu comparisons, no divergence%s\n",
+               argv[arg], (unsigned long long)done, (unsigned long long)ls.checks,
+               result == CHIP8_LOCKSTEP_KEY_WAIT ? " (stopped waiting for a key)" : "");
+
+    chip8_lockstep_free(&ls);
+    free(events);
+    chip8_tcache_close(tc);
+    chip8_aot_unload(aot);
+
+    return result == CHIP8_LOCKSTEP_DIVERGED;
+}
@@ -0,0 +1,87 @@
+/*
+ *  chip8dis.c
+ *  chip8emu
+ *
+ *  Disassembles whole ROMs into listings or DOT control flow graphs.
+ *
+ *  usage: chip8dis [-d] [-t] <rom>...
+ *
+ *  -d writes the control flow graph in DOT format instead of a listing,
+ *  -t reports how long analysis and output took per ROM.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chip8.h"
+#include "disasm.h"
+
+
+static double now_us()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int main(int argc, char **argv)
+{
+    static chip8_disasm_t d;
+    static char out[1 << 20];
+    static u8 rom[CHIP8_PROG_SIZE + 1];
+    int dot = 0, timing = 0, status = 0;
+    int arg = 1;
+
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-d") == 0)
+            dot = 1;
+        else if (strcmp(argv[arg], "-t") == 0)
+            timing = 1;
+        else
+            break;
+    }
+
+    if (arg >= argc) {
+        fprintf(stderr, "usage: %s [-d] [-t] <rom>...\n", argv[0]);
+        return 2;
+    }
+
+    for (; arg < argc; arg++) {
+        FILE *file = fopen(argv[arg], "rb");
+        u32 size;
+
+        if (!file) {
+            fprintf(stderr, "Unable to open %s\n", argv[arg]);
+            status = 1;
+            continue;
+        }
+
+        size = fread(rom, sizeof(u8), sizeof(rom), file);
+        fclose(file);
+
+        if (size > CHIP8_PROG_SIZE) {
+            fprintf(stderr, "%s does not fit into memory\n", argv[arg]);
+            status = 1;
+            continue;
+        }
+
+        double t0 = now_us();
+
+        chip8_disasm_analyze(rom, size, &d);
+        u32 len = dot ? chip8_disasm_dot(&d, out, sizeof(out)) : chip8_disasm_listing(&d, out, sizeof(out));
+
+        double t1 = now_us();
+
+        fwrite(out, 1, len < sizeof(out) ? len : sizeof(out) - 1, stdout);
+
+        if (timing)
+            fprintf(stderr, "%s: %.1f us\n", argv[arg], t1 - t0);
+    }
+
+    return status;
+}
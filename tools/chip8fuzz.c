@@ -0,0 +1,198 @@
+/*
+ *  chip8fuzz.c
+ *  chip8emu
+ *
+ *  libFuzzer harness. Each input is a ROM image, or with CHIP8_FUZZ_ROM
+ *  set, a key sequence played into that ROM. Guest control flow edges
+ *  are fed back as extra coverage counters, and accesses outside the
+ *  stack, memory or key registers abort even where they would not crash
+ *  the host.
+ *
+ *  build: clang -O1 -g -fsanitize=fuzzer,address -I. tools/chip8fuzz.c chip8.c
+ *  replay without libFuzzer: cc -DCHIP8_FUZZ_STANDALONE -I. tools/chip8fuzz.c chip8.c
+ *
+ *  CHIP8_FUZZ_CYCLES bounds the instructions per input, 1000 by default.
+ *  unimplemented instructions print, run with -close_fd_mask=1.
+ *
+ *  key sequences are byte pairs: instructions to run before the event,
+ *  then the key in the low nibble with 0x10 set for a press.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "chip8.h"
+
+
+#define EDGES (1 << 16)
+
+// libFuzzer picks up counters in this section as coverage
+#ifdef __linux__
+__attribute__((section("__libfuzzer_extra_counters")))
+#endif
+static u8 edges[EDGES];
+
+static chip8_state_t state;
+static chip8_state_t pristine;
+static u32 max_cycles = 1000;
+static int key_mode = 0;
+
+
+static void fuzz_bug(const char *what, u16 opcode)
+{
+    const chip8_cpu_t *cpu = &state.cpu;
+
+    fprintf(stderr, "chip8fuzz: %s at pc=%03x opcode=%04x i=%03x sp=%u\n",
+            what, cpu->pc, opcode, cpu->ireg, cpu->sp);
+    abort();
+}
+
+// these would scribble over neighbouring fields without the host noticing
+static void fuzz_check(u16 opcode)
+{
+    const chip8_cpu_t *cpu = &state.cpu;
+    u32 n = 0;
+
+    switch (chip8_decode_instruction(opcode)) {
+        case I_JSR:
+            if (cpu->sp >= 16)
+                fuzz_bug("stack overflow", opcode);
+            return;
+
+        case I_RTS:
+            if (cpu->sp == 0)
+                fuzz_bug("stack underflow", opcode);
+            return;
+
+        // the key register array only has 16 entries
+        case I_SKPR:
+        case I_SKUP:
+            if (cpu->dreg[(opcode & 0x0F00) >> 8] > 15)
+                fuzz_bug("key index out of range", opcode);
+            return;
+
+        case I_SPRITE:
+            n = opcode & 0xF;
+            break;
+
+        case I_LDR:
+        case I_STR:
+            n = (opcode & 0x0F00) >> 8;
+            break;
+
+        case I_BCD:
+            n = 3;
+            break;
+
+        default:
+            return;
+    }
+
+    if (cpu->ireg + n > 4096)
+        fuzz_bug("memory access out of range", opcode);
+}
+
+static void fuzz_run(u32 cycles, u16 *prev)
+{
+    for (u32 n = 0; n < cycles && !chip8_waiting_key(); n++) {
+        u16 pc = state.cpu.pc;
+
+        if (pc > 4094)
+            fuzz_bug("fetch out of range", 0);
+
+        fuzz_check((chip8_peek(&state, pc) << 8) | chip8_peek(&state, pc + 1));
+
+        // afl style edge hash, pc is even for all sane code
+        edges[(pc ^ (*prev >> 1)) * 0x9E37 & (EDGES - 1)]++;
+        *prev = pc;
+
+        chip8_execute_step();
+    }
+}
+
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+    const char *rom = getenv("CHIP8_FUZZ_ROM");
+    const char *cycles = getenv("CHIP8_FUZZ_CYCLES");
+
+    if (cycles)
+        max_cycles = atoi(cycles);
+
+    chip8_select_state(&state);
+    chip8_reset_state();
+
+    if (rom) {
+        if (!chip8_load_rom(rom)) {
+            fprintf(stderr, "Unable to load %s\n", rom);
+            exit(1);
+        }
+        key_mode = 1;
+    }
+
+    chip8_save_state(&pristine);
+
+    return 0;
+}
+
+int LLVMFuzzerTestOneInput(const u8 *data, size_t size)
+{
+    u16 prev = 0;
+
+    // undo only what the last input touched
+    chip8_restore_state(&pristine);
+
+    if (!key_mode) {
+        if (size > CHIP8_PROG_SIZE)
+            return 0;
+
+        // marks the pages dirty, so the next restore clears them again
+        chip8_write_mem(CHIP8_PROG_START, data, size);
+
+        fuzz_run(max_cycles, &prev);
+        return 0;
+    }
+
+    u32 budget = max_cycles;
+
+    for (size_t i = 0; i + 1 < size && budget; i += 2) {
+        u32 cycles = data[i] < budget ? data[i] : budget;
+
+        fuzz_run(cycles, &prev);
+        budget -= cycles;
+
+        chip8_key_event(data[i + 1] & 0xF, (data[i + 1] & 0x10) != 0);
+    }
+
+    fuzz_run(budget, &prev);
+
+    return 0;
+}
+
+#ifdef CHIP8_FUZZ_STANDALONE
+
+// runs inputs given as files once each, for reproducing crashes
+int main(int argc, char **argv)
+{
+    static u8 data[1 << 16];
+
+    LLVMFuzzerInitialize(&argc, &argv);
+
+    for (int arg = 1; arg < argc; arg++) {
+        FILE *file = fopen(argv[arg], "rb");
+
+        if (!file) {
+            fprintf(stderr, "Unable to open %s\n", argv[arg]);
+            return 1;
+        }
+
+        size_t size = fread(data, 1, sizeof(data), file);
+        fclose(file);
+
+        LLVMFuzzerTestOneInput(data, size);
+    }
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,134 @@
+/*
+ *  chip8srv.c
+ *  chip8emu
+ *
+ *  Headless server, runs instances of a rom at full speed timing and
+ *  publishes every frame for chip8view and other local readers.
+ *
+ *  usage: chip8srv [-n instances] [-s name] <rom>
+ *
+ *  frames go to the shared memory segment /chip8-<name>, key events are
+ *  read from $TMPDIR/chip8-<name>.sock. the name defaults to "default".
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+#include "chip8.h"
+#include "framesrv.h"
+
+
+static volatile sig_atomic_t running = 1;
+
+
+static void stop(int sig)
+{
+    running = 0;
+}
+
+static u64 now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+    chip8_framesrv_t fs;
+    chip8_fs_input_t ev;
+    chip8_state_t *states;
+    static chip8_image_t image;
+    const char *name = "default";
+    u32 count = 1;
+    int arg = 1;
+
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-n") == 0 && arg + 1 < argc)
+            count = atoi(argv[++arg]);
+        else if (strcmp(argv[arg], "-s") == 0 && arg + 1 < argc)
+            name = argv[++arg];
+        else
+            break;
+    }
+
+    if (arg >= argc || count < 1 || count > 256) {
+        fprintf(stderr, "usage: %s [-n instances] [-s name] <rom>\n", argv[0]);
+        return 2;
+    }
+
+    if (!(states = calloc(count, sizeof(chip8_state_t))))
+        return 1;
+
+    chip8_reset_state();
+
+    if (!chip8_load_rom(argv[arg])) {
+        fprintf(stderr, "Unable to load %s\n", argv[arg]);
+        return 1;
+    }
+
+    // every instance maps the program, pages are only copied once written
+    chip8_save_image(&image);
+
+    for (u32 i = 0; i < count; i++) {
+        chip8_select_state(&states[i]);
+        chip8_reset_state();
+        chip8_map_image(&image);
+        chip8_seed_rng(0x2545F491u * (i + 1));
+    }
+
+    if (!chip8_framesrv_create(&fs, name, count)) {
+        fprintf(stderr, "Unable to create frame server %s\n", name);
+        return 1;
+    }
+
+    fprintf(stderr, "serving %u instance%s as %s, input on %s\n",
+            count, count == 1 ? "" : "s", fs.name, fs.sock_path);
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    u64 frame_ns = 1000000000ULL / CHIP8_FRAMES_PER_SECOND;
+    u64 next_frame = now_ns();
+
+    while (running) {
+        while (chip8_framesrv_poll_input(&fs, &ev)) {
+            chip8_select_state(&states[ev.instance]);
+            chip8_key_event(ev.key, ev.status);
+        }
+
+        for (u32 i = 0; i < count; i++) {
+            chip8_select_state(&states[i]);
+            chip8_run_frame(0);
+            chip8_framesrv_publish(&fs, i, states[i].vram, states[i].cycles);
+        }
+
+        u64 now = now_ns();
+
+        next_frame += frame_ns;
+
+        if ((s64)(next_frame - now) > 0) {
+            struct timespec ts = { 0, next_frame - now };
+
+            nanosleep(&ts, 0);
+        } else if (now - next_frame > 100000000ULL)
+            next_frame = now;
+    }
+
+    for (u32 i = 0; i < count; i++) {
+        chip8_select_state(&states[i]);
+        chip8_release_state();
+    }
+
+    chip8_select_state(0);
+    chip8_framesrv_close(&fs);
+    free(states);
+
+    return 0;
+}
@@ -0,0 +1,169 @@
+/*
+ *  chip8term.c
+ *  chip8emu
+ *
+ *  Text mode frontend for terminals and ssh sessions.
+ *
+ *  usage: chip8term [-b] [-f fps] <rom>
+ *
+ *  -b draws with braille instead of half blocks, -f caps how often the
+ *  screen is redrawn, 30 times a second by default. keys 1234 qwer asdf
+ *  zxcv form the hex keypad, escape quits.
+ *
+ *  output goes out non-blocking and a new frame is only rendered once
+ *  the terminal took the previous one, so slow links skip frames
+ *  instead of queueing them up.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "chip8.h"
+#include "termview.h"
+
+
+static volatile sig_atomic_t running = 1;
+static struct termios saved_termios;
+
+
+static void stop(int sig)
+{
+    running = 0;
+}
+
+static u64 now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void restore_terminal()
+{
+    static const char reset[] = "\x1b[?25h\x1b[0m\x1b[18;1H\n";
+
+    tcsetattr(STDIN_FILENO, TCSANOW, &saved_termios);
+    fcntl(STDOUT_FILENO, F_SETFL, fcntl(STDOUT_FILENO, F_GETFL) & ~O_NONBLOCK);
+    if (write(STDOUT_FILENO, reset, sizeof(reset) - 1) < 0)
+        return;
+}
+
+int main(int argc, char **argv)
+{
+    static char out[CHIP8_TERM_MAX_OUTPUT];
+    chip8_termview_t view;
+    chip8_term_mode_t mode = CHIP8_TERM_HALF;
+    u32 fps = 30, pending = 0, sent = 0;
+    u8 held[16] = { 0 };
+    int arg = 1;
+
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-b") == 0)
+            mode = CHIP8_TERM_BRAILLE;
+        else if (strcmp(argv[arg], "-f") == 0 && arg + 1 < argc)
+            fps = atoi(argv[++arg]);
+        else
+            break;
+    }
+
+    if (arg >= argc || !fps) {
+        fprintf(stderr, "usage: %s [-b] [-f fps] <rom>\n", argv[0]);
+        return 2;
+    }
+
+    chip8_reset_state();
+
+    if (!chip8_load_rom(argv[arg])) {
+        fprintf(stderr, "Unable to load %s\n", argv[arg]);
+        return 1;
+    }
+
+    // raw, non-blocking input
+    struct termios raw;
+
+    if (tcgetattr(STDIN_FILENO, &saved_termios) != 0) {
+        fprintf(stderr, "Not a terminal\n");
+        return 1;
+    }
+
+    raw = saved_termios;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    fcntl(STDOUT_FILENO, F_SETFL, fcntl(STDOUT_FILENO, F_GETFL) | O_NONBLOCK);
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    chip8_termview_init(&view, mode);
+
+    u64 frame_ns = 1000000000ULL / CHIP8_FRAMES_PER_SECOND;
+    u64 draw_ns = 1000000000ULL / fps;
+    u64 next_frame = now_ns(), next_draw = next_frame;
+
+    while (running) {
+        char input[64];
+        u8 keys[64];
+        ssize_t n = read(STDIN_FILENO, input, sizeof(input));
+        int count = n > 0 ? chip8_term_keys(input, n, keys) : 0;
+
+        // a lone escape quits
+        if (count < 0)
+            running = 0;
+
+        for (int i = 0; i < count; i++) {
+            chip8_key_event(keys[i], 1);
+            held[keys[i]] = CHIP8_TERM_KEY_HOLD_FRAMES;
+        }
+
+        for (u32 k = 0; k < 16; k++)
+            if (held[k] && --held[k] == 0)
+                chip8_key_event(k, 0);
+
+        // run a logic frame, a parked cpu waits for the next key
+        chip8_run_frame(0);
+
+        u64 now = now_ns();
+
+        // finish the last frame before rendering the next
+        if (pending) {
+            ssize_t w = write(STDOUT_FILENO, out + sent, pending);
+
+            if (w > 0) {
+                sent += w;
+                pending -= w;
+            } else if (w < 0 && errno != EAGAIN && errno != EINTR)
+                break;
+        }
+
+        if (!pending && (s64)(now - next_draw) >= 0) {
+            pending = chip8_termview_render(&view, chip8_get_vram(), out);
+            sent = 0;
+            next_draw = now + draw_ns;
+        }
+
+        next_frame += frame_ns;
+
+        if ((s64)(next_frame - now) > 0) {
+            struct timespec ts = { 0, next_frame - now };
+
+            nanosleep(&ts, 0);
+        } else if (now - next_frame > 100000000ULL)
+            next_frame = now;
+    }
+
+    restore_terminal();
+
+    return 0;
+}
@@ -0,0 +1,147 @@
+/*
+ *  chip8view.c
+ *  chip8emu
+ *
+ *  Terminal viewer for an instance published by chip8srv.
+ *
+ *  usage: chip8view [-b] [-s name] [instance]
+ *
+ *  frames are rendered straight from the shared slot and dropped if the
+ *  server rewrote it meanwhile. keys 1234 qwer asdf zxcv are sent to the
+ *  instance being watched, escape quits. any number of viewers can
+ *  watch the same instance.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "framesrv.h"
+#include "termview.h"
+
+
+static volatile sig_atomic_t running = 1;
+
+
+static void stop(int sig)
+{
+    running = 0;
+}
+
+int main(int argc, char **argv)
+{
+    static char out[CHIP8_TERM_MAX_OUTPUT];
+    chip8_framesrv_t fs;
+    chip8_termview_t view, prev;
+    chip8_term_mode_t mode = CHIP8_TERM_HALF;
+    struct termios saved, raw;
+    const char *name = "default";
+    u32 instance = 0, seen = 0, dropped = 0;
+    u8 held[16] = { 0 };
+    int arg = 1;
+
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-b") == 0)
+            mode = CHIP8_TERM_BRAILLE;
+        else if (strcmp(argv[arg], "-s") == 0 && arg + 1 < argc)
+            name = argv[++arg];
+        else
+            break;
+    }
+
+    if (arg < argc)
+        instance = atoi(argv[arg++]);
+
+    if (arg < argc) {
+        fprintf(stderr, "usage: %s [-b] [-s name] [instance]\n", argv[0]);
+        return 2;
+    }
+
+    if (!chip8_framesrv_open(&fs, name)) {
+        fprintf(stderr, "No frame server named %s\n", name);
+        return 1;
+    }
+
+    if (instance >= fs.shm->instances) {
+        fprintf(stderr, "Server %s has %u instances\n", name, fs.shm->instances);
+        return 1;
+    }
+
+    if (tcgetattr(STDIN_FILENO, &saved) != 0) {
+        fprintf(stderr, "Not a terminal\n");
+        return 1;
+    }
+
+    raw = saved;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    chip8_termview_init(&view, mode);
+
+    while (running) {
+        char input[64];
+        u8 keys[64];
+        ssize_t n = read(STDIN_FILENO, input, sizeof(input));
+        int count = n > 0 ? chip8_term_keys(input, n, keys) : 0;
+
+        // a lone escape quits
+        if (count < 0)
+            running = 0;
+
+        for (int i = 0; i < count; i++) {
+            chip8_framesrv_send_key(&fs, instance, keys[i], 1);
+            held[keys[i]] = CHIP8_TERM_KEY_HOLD_FRAMES;
+        }
+
+        // sleeps until the server publishes, frames are the clock here
+        u32 published = chip8_framesrv_wait(&fs, instance, seen, 100);
+
+        if (published == seen)
+            continue;
+
+        seen = published;
+
+        for (u32 k = 0; k < 16; k++)
+            if (held[k] && --held[k] == 0)
+                chip8_framesrv_send_key(&fs, instance, k, 0);
+
+        u32 seq;
+        const chip8_frame_slot_t *slot = chip8_framesrv_latest(&fs, instance, &seq);
+
+        if (!slot)
+            continue;
+
+        prev = view;
+        u32 len = chip8_termview_render(&view, slot->vram, out);
+
+        // torn read, forget it and take the next frame
+        if (!chip8_framesrv_valid(slot, seq)) {
+            view = prev;
+            dropped++;
+            continue;
+        }
+
+        if (fwrite(out, 1, len, stdout) != len)
+            break;
+        fflush(stdout);
+    }
+
+    tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+    printf("\x1b[?25h\x1b[0m\x1b[18;1H\n");
+
+    if (dropped)
+        fprintf(stderr, "%u torn frames dropped\n", dropped);
+
+    chip8_framesrv_close(&fs);
+
+    return 0;
+}
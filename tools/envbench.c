@@ -0,0 +1,102 @@
+/*
+ *  envbench.c
+ *  chip8emu
+ *
+ *  Measures batched environment throughput with random actions.
+ *
+ *  usage: envbench [-b] <rom> [instances] [steps]
+ *
+ *  -b uses bit-packed observations instead of one byte per pixel.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chip8.h"
+#include "env.h"
+
+
+static double now_s()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    static u8 rom[CHIP8_PROG_SIZE + 1];
+    chip8_env_t env;
+    int arg = 1, bits = 0;
+
+    if (arg < argc && strcmp(argv[arg], "-b") == 0) {
+        bits = 1;
+        arg++;
+    }
+
+    if (arg >= argc) {
+        fprintf(stderr, "usage: %s [-b] <rom> [instances] [steps]\n", argv[0]);
+        return 2;
+    }
+
+    FILE *file = fopen(argv[arg], "rb");
+    if (!file) {
+        fprintf(stderr, "Unable to open %s\n", argv[arg]);
+        return 1;
+    }
+
+    u32 size = fread(rom, sizeof(u8), sizeof(rom), file);
+    fclose(file);
+
+    u32 count = arg + 1 < argc ? atoi(argv[arg + 1]) : 64;
+    u32 steps = arg + 2 < argc ? atoi(argv[arg + 2]) : 1000;
+
+    if (!count || !chip8_env_init(&env, count, rom, size, 0)) {
+        fprintf(stderr, "Unable to set up %u instances of %s\n", count, argv[arg]);
+        return 1;
+    }
+
+    env.obs = bits ? CHIP8_ENV_OBS_BITS : CHIP8_ENV_OBS_BYTES;
+    env.max_frames = 3600;
+
+    u8 *actions = malloc(count);
+    u8 *obs = malloc(count * chip8_env_obs_size(&env));
+    float *rewards = malloc(count * sizeof(float));
+    u8 *done = malloc(count);
+
+    if (!actions || !obs || !rewards || !done) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    chip8_env_reset(&env, obs);
+
+    u32 rng = 1;
+    double t0 = now_s();
+
+    for (u32 n = 0; n < steps; n++) {
+        for (u32 i = 0; i < count; i++) {
+            rng = rng * 1103515245 + 12345;
+            actions[i] = (rng >> 16) % 17 == 16 ? CHIP8_ENV_NOOP : (rng >> 16) % 16;
+        }
+
+        chip8_env_step(&env, actions, obs, rewards, done);
+    }
+
+    double t = now_s() - t0;
+
+    printf("%u instances, %u steps: %.0f frames/s\n", count, steps, count * (double)steps / t);
+
+    free(actions);
+    free(obs);
+    free(rewards);
+    free(done);
+    chip8_env_free(&env);
+
+    return 0;
+}
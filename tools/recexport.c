@@ -0,0 +1,78 @@
+/*
+ *  recexport.c
+ *  chip8emu
+ *
+ *  Exports framebuffer recordings to an animated GIF or a PNG sequence.
+ *
+ *  usage: recexport [-s scale] <recording> <out.gif>
+ *         recexport [-s scale] -p <recording> <prefix>
+ *
+ *  -p writes every frame to <prefix>NNNNNN.png instead. without an
+ *  output, prints the frame count and rate.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "recorder.h"
+
+
+int main(int argc, char **argv)
+{
+    chip8_playback_t p;
+    u32 scale = 4;
+    int png = 0, arg = 1;
+
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-p") == 0)
+            png = 1;
+        else if (strcmp(argv[arg], "-s") == 0 && arg + 1 < argc)
+            scale = atoi(argv[++arg]);
+        else
+            break;
+    }
+
+    if (arg >= argc || !scale) {
+        fprintf(stderr, "usage: %s [-s scale] [-p] <recording> [<out.gif> | <prefix>]\n", argv[0]);
+        return 2;
+    }
+
+    if (!chip8_playback_open(&p, argv[arg])) {
+        fprintf(stderr, "Unable to open %s\n", argv[arg]);
+        return 1;
+    }
+
+    if (arg + 1 >= argc) {
+        printf("%u frames at %u fps\n", p.count, p.fps);
+        chip8_playback_close(&p);
+        return 0;
+    }
+
+    const char *out = argv[arg + 1];
+    int ok = 1;
+
+    if (png) {
+        char path[1024];
+
+        while (ok && chip8_playback_next(&p)) {
+            snprintf(path, sizeof(path), "%s%06u.png", out, p.index - 1);
+            ok = chip8_export_png(p.frame, path, scale);
+        }
+    } else
+        ok = chip8_export_gif(&p, out, scale);
+
+    if (ok && p.index < p.count)
+        fprintf(stderr, "%s is truncated after %u of %u frames\n", argv[arg], p.index, p.count);
+
+    chip8_playback_close(&p);
+
+    if (!ok) {
+        fprintf(stderr, "Unable to write %s\n", out);
+        return 1;
+    }
+
+    return 0;
+}
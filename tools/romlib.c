@@ -0,0 +1,52 @@
+/*
+ *  romlib.c
+ *  chip8emu
+ *
+ *  Builds and lists ROM library archives.
+ *
+ *  usage: romlib build <rom directory> <archive>
+ *         romlib list <archive>
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "romlib.h"
+
+
+static const char *variant_names[] = { "chip8", "schip" };
+
+int main(int argc, char **argv)
+{
+    if (argc == 4 && strcmp(argv[1], "build") == 0) {
+        if (!chip8_romlib_build(argv[2], argv[3])) {
+            fprintf(stderr, "Unable to build %s from %s\n", argv[3], argv[2]);
+            return 1;
+        }
+        return 0;
+    }
+    
+    if (argc == 3 && strcmp(argv[1], "list") == 0) {
+        chip8_romlib_t *lib = chip8_romlib_open(argv[2]);
+        
+        if (!lib) {
+            fprintf(stderr, "Unable to open %s\n", argv[2]);
+            return 1;
+        }
+        
+        for (u32 i = 0; i < lib->count; i++) {
+            const chip8_romlib_entry_t *e = &lib->entries[i];
+            
+            printf("%016llx %5u %-5s %.32s\n", e->hash, e->size,
+                   variant_names[e->variant], e->title);
+        }
+        
+        chip8_romlib_close(lib);
+        return 0;
+    }
+    
+    fprintf(stderr, "usage: %s build <dir> <archive> | list <archive>\n", argv[0]);
+    return 2;
+}
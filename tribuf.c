@@ -0,0 +1,80 @@
+/*
+ *  tribuf.c
+ *  chip8emu
+ *
+ *  Lock-free triple buffer handing completed frames from one producer
+ *  thread to one consumer thread. The producer never waits and the
+ *  consumer always sees the newest complete frame.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "tribuf.h"
+
+
+#define TRIBUF_FRESH 0x4
+#define TRIBUF_INDEX 0x3
+
+
+int chip8_tribuf_init(chip8_tribuf_t *tb, u32 size)
+{
+    assert(tb);
+
+    memset(tb, 0, sizeof(chip8_tribuf_t));
+
+    for (int i = 0; i < 3; i++) {
+        if ((tb->buffers[i] = calloc(1, size)) == 0) {
+            chip8_tribuf_free(tb);
+            return 0;
+        }
+    }
+
+    tb->size = size;
+    tb->back = 0;
+    tb->middle = 1;
+    tb->front = 2;
+
+    return 1;
+}
+
+void chip8_tribuf_free(chip8_tribuf_t *tb)
+{
+    for (int i = 0; i < 3; i++) {
+        free(tb->buffers[i]);
+        tb->buffers[i] = 0;
+    }
+}
+
+u8 *chip8_tribuf_back(chip8_tribuf_t *tb)
+{
+    return tb->buffers[tb->back];
+}
+
+// hand the back buffer over and take whatever the consumer left behind
+void chip8_tribuf_publish(chip8_tribuf_t *tb)
+{
+    u32 prev = __atomic_exchange_n(&tb->middle, tb->back | TRIBUF_FRESH, __ATOMIC_ACQ_REL);
+
+    tb->back = prev & TRIBUF_INDEX;
+}
+
+// swap in the newest frame, returns 0 if nothing was published since
+int chip8_tribuf_acquire(chip8_tribuf_t *tb)
+{
+    if (!(__atomic_load_n(&tb->middle, __ATOMIC_ACQUIRE) & TRIBUF_FRESH))
+        return 0;
+
+    u32 prev = __atomic_exchange_n(&tb->middle, tb->front, __ATOMIC_ACQ_REL);
+
+    tb->front = prev & TRIBUF_INDEX;
+
+    return 1;
+}
+
+const u8 *chip8_tribuf_front(const chip8_tribuf_t *tb)
+{
+    return tb->buffers[tb->front];
+}
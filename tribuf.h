@@ -0,0 +1,37 @@
+/*
+ *  tribuf.h
+ *  chip8emu
+ *
+ *  Lock-free triple buffer handing completed frames from one producer
+ *  thread to one consumer thread. The producer never waits and the
+ *  consumer always sees the newest complete frame.
+ *
+ */
+
+#ifndef TRIBUF_H
+#define TRIBUF_H
+
+#include "types.h"
+
+
+typedef struct {
+    u8 *buffers[3];
+    u32 size;
+    u32 back;       // owned by the producer
+    u32 front;      // owned by the consumer
+    u32 middle;     // shared, index plus fresh bit
+} chip8_tribuf_t;
+
+int chip8_tribuf_init(chip8_tribuf_t *tb, u32 size);
+void chip8_tribuf_free(chip8_tribuf_t *tb);
+
+// producer
+u8 *chip8_tribuf_back(chip8_tribuf_t *tb);
+void chip8_tribuf_publish(chip8_tribuf_t *tb);
+
+// consumer
+int chip8_tribuf_acquire(chip8_tribuf_t *tb);
+const u8 *chip8_tribuf_front(const chip8_tribuf_t *tb);
+
+
+#endif // TRIBUF_H